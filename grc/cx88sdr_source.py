@@ -0,0 +1,366 @@
+# SPDX-License-Identifier: GPL-2.0-or-later
+#
+# Copyright (c) 2020 Jorge Maidana <jorgem.seq@gmail.com>
+#
+# GNU Radio source for cx88_sdr cards.
+#
+# The handle is switched to CS8 or CS16LE, so the driver's fs/4 DDC does
+# the real to complex conversion while copying and this block only scales
+# the signed I/Q into complex floats, one numpy pass straight into the
+# output buffer. Sample rate, gain, input and max latency are set through
+# V4L2 ioctls. Driver events become stream tags:
+#
+#   rx_rate   (double) complex sample rate, on the first sample and after
+#             every reconfiguration
+#   rx_input  (long)   input pin 0..3, same places
+#   rx_drop   (uint64) samples the driver skipped right before this one
+
+import ctypes
+import errno
+import fcntl
+import os
+import select
+
+import numpy as np
+import pmt
+from gnuradio import gr
+
+# videodev2.h
+_IOC_WRITE = 1
+_IOC_READ = 2
+
+
+def _ioc(direction, nr, struct):
+    return (direction << 30) | (ctypes.sizeof(struct) << 16) | (ord('V') << 8) | nr
+
+
+def _fourcc(code):
+    return ord(code[0]) | ord(code[1]) << 8 | ord(code[2]) << 16 | ord(code[3]) << 24
+
+
+V4L2_BUF_TYPE_SDR_CAPTURE = 11
+V4L2_TUNER_SDR = 4
+V4L2_SDR_FMT_CS8 = _fourcc('CS08')
+V4L2_SDR_FMT_CS16LE = _fourcc('CS16')
+
+V4L2_CID_GAIN = 0x00980900 + 19
+
+# cx88_sdr_uapi.h
+V4L2_CID_USER_CX88SDR_BASE = 0x00980900 + 0x1f10
+V4L2_CID_CX88SDR_INPUT = V4L2_CID_USER_CX88SDR_BASE + 0
+V4L2_CID_CX88SDR_MAX_LATENCY = V4L2_CID_USER_CX88SDR_BASE + 2
+
+V4L2_EVENT_PRIVATE_START = 0x08000000
+V4L2_EVENT_CX88SDR_DISCONTINUITY = V4L2_EVENT_PRIVATE_START + 0
+V4L2_EVENT_CX88SDR_RECONFIG = V4L2_EVENT_PRIVATE_START + 1
+
+
+class v4l2_sdr_format(ctypes.Structure):
+    _fields_ = [('pixelformat', ctypes.c_uint32),
+                ('buffersize', ctypes.c_uint32),
+                ('reserved', ctypes.c_uint8 * 24)]
+
+
+class _v4l2_format_u(ctypes.Union):
+    # The other members hold pointers, which sets the alignment
+    _fields_ = [('sdr', v4l2_sdr_format),
+                ('raw_data', ctypes.c_uint8 * 200),
+                ('align', ctypes.c_void_p)]
+
+
+class v4l2_format(ctypes.Structure):
+    _fields_ = [('type', ctypes.c_uint32),
+                ('fmt', _v4l2_format_u)]
+
+
+class v4l2_frequency(ctypes.Structure):
+    _fields_ = [('tuner', ctypes.c_uint32),
+                ('type', ctypes.c_uint32),
+                ('frequency', ctypes.c_uint32),
+                ('reserved', ctypes.c_uint32 * 8)]
+
+
+class v4l2_control(ctypes.Structure):
+    _fields_ = [('id', ctypes.c_uint32),
+                ('value', ctypes.c_int32)]
+
+
+class v4l2_event_subscription(ctypes.Structure):
+    _fields_ = [('type', ctypes.c_uint32),
+                ('id', ctypes.c_uint32),
+                ('flags', ctypes.c_uint32),
+                ('reserved', ctypes.c_uint32 * 5)]
+
+
+class _v4l2_event_u(ctypes.Union):
+    _fields_ = [('data', ctypes.c_uint8 * 64),
+                ('align', ctypes.c_int64)]
+
+
+class timespec(ctypes.Structure):
+    _fields_ = [('tv_sec', ctypes.c_long),
+                ('tv_nsec', ctypes.c_long)]
+
+
+class v4l2_event(ctypes.Structure):
+    _fields_ = [('type', ctypes.c_uint32),
+                ('u', _v4l2_event_u),
+                ('pending', ctypes.c_uint32),
+                ('sequence', ctypes.c_uint32),
+                ('timestamp', timespec),
+                ('id', ctypes.c_uint32),
+                ('reserved', ctypes.c_uint32 * 8)]
+
+
+class v4l2_event_cx88sdr_discontinuity(ctypes.Structure):
+    _fields_ = [('offset', ctypes.c_uint64),
+                ('skipped', ctypes.c_uint64)]
+
+
+class v4l2_event_cx88sdr_reconfig(ctypes.Structure):
+    _fields_ = [('offset', ctypes.c_uint64),
+                ('mixed', ctypes.c_uint64),
+                ('pixelformat', ctypes.c_uint32),
+                ('rate', ctypes.c_uint32),
+                ('input', ctypes.c_uint32),
+                ('reserved', ctypes.c_uint32)]
+
+
+VIDIOC_G_FMT = _ioc(_IOC_READ | _IOC_WRITE, 4, v4l2_format)
+VIDIOC_S_FMT = _ioc(_IOC_READ | _IOC_WRITE, 5, v4l2_format)
+VIDIOC_G_CTRL = _ioc(_IOC_READ | _IOC_WRITE, 27, v4l2_control)
+VIDIOC_S_CTRL = _ioc(_IOC_READ | _IOC_WRITE, 28, v4l2_control)
+VIDIOC_G_FREQUENCY = _ioc(_IOC_READ | _IOC_WRITE, 56, v4l2_frequency)
+VIDIOC_S_FREQUENCY = _ioc(_IOC_WRITE, 57, v4l2_frequency)
+VIDIOC_DQEVENT = _ioc(_IOC_READ, 89, v4l2_event)
+VIDIOC_SUBSCRIBE_EVENT = _ioc(_IOC_WRITE, 90, v4l2_event_subscription)
+
+PAGE_SIZE = 4096
+READ_SIZE = 1 << 20     # Bytes per read(), a whole number of pages
+POLL_MS = 100           # So a stopping flowgraph is never kept waiting
+
+# Sorted after a discontinuity at the same offset
+_DISC, _RECONFIG = 0, 1
+
+
+class cx88sdr_source(gr.sync_block):
+    """
+    Complex samples from a cx88_sdr card at half its real sample rate.
+
+    samp_rate is the complex rate (7159090, 14318181 or 17897726 with the
+    8-bit ADC, 3579545, 7159090 or 8948863 with the 16-bit one), 0 keeps
+    the current band. gain (0..31) and input (0..3) of -1 keep the current
+    setting. max_latency in us lets the driver drop data when the flowgraph
+    falls behind, the drop shows up as an rx_drop tag.
+    """
+
+    def __init__(self, device='/dev/swradio0', samp_rate=14318181, wide=False,
+                 gain=-1, input=-1, max_latency=0):
+        gr.sync_block.__init__(self, name='cx88sdr_source', in_sig=None,
+                               out_sig=[np.complex64])
+        self.device = device
+        self.samp_rate = int(samp_rate)
+        self.wide = bool(wide)
+        self.gain = int(gain)
+        self.input = int(input)
+        self.max_latency = int(max_latency)
+        self.fd = -1
+
+        # Reads land page aligned, the tail is left over from the last call
+        raw = np.zeros(READ_SIZE + PAGE_SIZE, dtype=np.uint8)
+        start = -raw.ctypes.data % PAGE_SIZE
+        self.buf = raw[start:start + READ_SIZE]
+
+        # Reads of a page at least
+        self.set_min_noutput_items(PAGE_SIZE // 2)
+
+    # Device access
+
+    def _ioctl(self, request, arg):
+        fcntl.ioctl(self.fd, request, arg)
+
+    def _set_ctrl(self, cid, value):
+        self._ioctl(VIDIOC_S_CTRL, v4l2_control(id=cid, value=value))
+
+    def _get_ctrl(self, cid):
+        ctrl = v4l2_control(id=cid)
+        self._ioctl(VIDIOC_G_CTRL, ctrl)
+        return ctrl.value
+
+    def _set_format(self):
+        fmt = v4l2_format(type=V4L2_BUF_TYPE_SDR_CAPTURE)
+        fmt.fmt.sdr.pixelformat = V4L2_SDR_FMT_CS16LE if self.wide else V4L2_SDR_FMT_CS8
+        self._ioctl(VIDIOC_S_FMT, fmt)
+        if fmt.fmt.sdr.pixelformat not in (V4L2_SDR_FMT_CS8, V4L2_SDR_FMT_CS16LE):
+            raise RuntimeError('%s: no complex output, driver too old' % self.device)
+
+    def _get_rate(self):
+        freq = v4l2_frequency(tuner=0, type=V4L2_TUNER_SDR)
+        self._ioctl(VIDIOC_G_FREQUENCY, freq)
+        return freq.frequency
+
+    def _subscribe(self, event_type):
+        self._ioctl(VIDIOC_SUBSCRIBE_EVENT, v4l2_event_subscription(type=event_type))
+
+    def _dequeue(self):
+        ev = v4l2_event()
+        while True:
+            try:
+                self._ioctl(VIDIOC_DQEVENT, ev)
+            except OSError as e:
+                if e.errno == errno.ENOENT:
+                    break
+                raise
+            data = bytes(ev.u.data)
+            if ev.type == V4L2_EVENT_CX88SDR_DISCONTINUITY:
+                d = v4l2_event_cx88sdr_discontinuity.from_buffer_copy(data)
+                self.events.append((d.offset, _DISC, d.skipped))
+            elif ev.type == V4L2_EVENT_CX88SDR_RECONFIG:
+                r = v4l2_event_cx88sdr_reconfig.from_buffer_copy(data)
+                self.events.append((r.offset, _RECONFIG, r))
+        # Reconfigurations may come before the data they apply to
+        self.events.sort(key=lambda e: (e[0], e[1]))
+
+    # GNU Radio
+
+    def start(self):
+        self.fd = os.open(self.device, os.O_RDONLY | os.O_NONBLOCK)
+        try:
+            self._set_format()
+            if self.samp_rate:
+                self.set_samp_rate(self.samp_rate)
+            self.set_gain(self.gain)
+            self.set_input(self.input)
+            self.set_max_latency(self.max_latency)
+            self._subscribe(V4L2_EVENT_CX88SDR_DISCONTINUITY)
+            self._subscribe(V4L2_EVENT_CX88SDR_RECONFIG)
+            rate = self._get_rate()
+            pin = self._get_ctrl(V4L2_CID_CX88SDR_INPUT)
+        except Exception:
+            os.close(self.fd)
+            self.fd = -1
+            raise
+
+        self.poller = select.poll()
+        self.poller.register(self.fd, select.POLLIN)
+        self.fill = 0           # Bytes waiting in buf
+        self.base = 0           # Returned bytes before buf[0]
+        self.skipped = 0        # Bytes skipped by the driver so far
+        self.events = []        # (stream offset, kind, payload), sorted
+        self.marks = []         # (returned bytes position, kind, payload)
+        self.marks.append((0, _RECONFIG, (rate, pin, self.wide)))
+        return True
+
+    def stop(self):
+        if self.fd >= 0:
+            os.close(self.fd)
+            self.fd = -1
+        return True
+
+    def _place_events(self):
+        """Turn stream offsets into positions in the returned bytes."""
+        end = self.base + self.fill
+        while self.events:
+            offset, kind, payload = self.events[0]
+            if kind == _DISC:
+                self.skipped += payload
+                self.marks.append((offset - self.skipped, _DISC, payload))
+            elif offset - self.skipped <= end:
+                # Every skip before it is known once the data got here
+                width = payload.pixelformat == V4L2_SDR_FMT_CS16LE
+                self.marks.append((offset - self.skipped, _RECONFIG,
+                                   (payload.rate, payload.input, width)))
+            else:
+                break
+            self.events.pop(0)
+
+    def _apply_mark(self, item, kind, payload):
+        if kind == _DISC:
+            unit = 4 if self.wide else 2
+            self.add_item_tag(0, item, pmt.intern('rx_drop'),
+                              pmt.from_uint64(payload // unit))
+            return
+        rate, pin, self.wide = payload
+        self.add_item_tag(0, item, pmt.intern('rx_rate'), pmt.from_double(rate))
+        self.add_item_tag(0, item, pmt.intern('rx_input'), pmt.from_long(pin))
+
+    def _convert(self, src, dst):
+        if self.wide:
+            np.multiply(src.view('<i2'), np.float32(1.0 / 32768),
+                        out=dst.view(np.float32), dtype=np.float32)
+        else:
+            np.multiply(src.view(np.int8), np.float32(1.0 / 128),
+                        out=dst.view(np.float32), dtype=np.float32)
+
+    def work(self, input_items, output_items):
+        out = output_items[0]
+        item = self.nitems_written(0)
+        produced = pos = 0
+
+        if self.fill < READ_SIZE // 2:
+            if not self.fill and not self.poller.poll(POLL_MS):
+                return 0
+            want = min(len(out) * (4 if self.wide else 2), READ_SIZE) - self.fill
+            want -= want % PAGE_SIZE if want > PAGE_SIZE else 0
+            if want > 0:
+                try:
+                    self.fill += os.readv(self.fd, [self.buf[self.fill:self.fill + want]])
+                except BlockingIOError:
+                    pass
+                except OSError as e:
+                    if e.errno in (errno.EINTR, errno.EAGAIN):
+                        pass
+                    elif e.errno == errno.ENODEV:
+                        return -1
+                    else:
+                        raise
+        self._dequeue()
+        self._place_events()
+
+        # Convert up to the next mark, which may change the width
+        while produced < len(out):
+            # Tags go on samples produced in this call
+            while pos < self.fill and self.marks and self.marks[0][0] <= self.base + pos:
+                _, kind, payload = self.marks.pop(0)
+                self._apply_mark(item + produced, kind, payload)
+
+            unit = 4 if self.wide else 2
+            stop = self.fill
+            if self.marks and self.marks[0][0] < self.base + stop:
+                stop = self.marks[0][0] - self.base
+            n = min((stop - pos) // unit, len(out) - produced)
+            if n <= 0:
+                break
+            self._convert(self.buf[pos:pos + n * unit], out[produced:produced + n])
+            pos += n * unit
+            produced += n
+
+        # Keep the rest for the next call
+        self.buf[:self.fill - pos] = self.buf[pos:self.fill]
+        self.fill -= pos
+        self.base += pos
+        return produced
+
+    # Callbacks
+
+    def set_samp_rate(self, samp_rate):
+        self.samp_rate = int(samp_rate)
+        if self.fd >= 0 and self.samp_rate:
+            self._ioctl(VIDIOC_S_FREQUENCY,
+                        v4l2_frequency(tuner=0, type=V4L2_TUNER_SDR,
+                                       frequency=self.samp_rate))
+
+    def set_gain(self, gain):
+        self.gain = int(gain)
+        if self.fd >= 0 and self.gain >= 0:
+            self._set_ctrl(V4L2_CID_GAIN, self.gain)
+
+    def set_input(self, input):
+        self.input = int(input)
+        if self.fd >= 0 and self.input >= 0:
+            self._set_ctrl(V4L2_CID_CX88SDR_INPUT, self.input)
+
+    def set_max_latency(self, max_latency):
+        self.max_latency = int(max_latency)
+        if self.fd >= 0:
+            self._set_ctrl(V4L2_CID_CX88SDR_MAX_LATENCY, self.max_latency)
@@ -0,0 +1,195 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (c) 2020 Jorge Maidana <jorgem.seq@gmail.com>
+ *
+ * cx88sdr_bench - throughput of one reactor thread serving 1 to 32 devices
+ *
+ * The device list is used in steps of 1, 2, 4, ... handles, the same node
+ * may be given more than once to get several readers of one card. Every
+ * step reports the aggregate rate and the CPU time spent per byte, which
+ * is what limits how many cards one thread keeps up with.
+ */
+
+#include <cerrno>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <getopt.h>
+#include <sys/resource.h>
+
+#include "cx88sdr/cx88sdr.hpp"
+
+static constexpr unsigned int max_devices = 32;
+
+static struct {
+	size_t		block_size	= 256 << 10;
+	unsigned int	blocks		= 8;
+	unsigned int	retain		= 0;
+	double		seconds		= 5.0;
+	bool		oldest		= false;
+} opt;
+
+struct counters {
+	uint64_t	chunks = 0;
+	uint64_t	gap = 0;
+	uint32_t	sum = 0;
+	/* Chunks held like a consumer working on them elsewhere would */
+	std::deque<cx88sdr::block_ref> held;
+};
+
+static double cpu_time()
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec * 1e-6 +
+	       ru.ru_stime.tv_sec + ru.ru_stime.tv_usec * 1e-6;
+}
+
+static double wall_time()
+{
+	using clock = std::chrono::steady_clock;
+
+	return std::chrono::duration<double>(clock::now().time_since_epoch()).count();
+}
+
+static int run(const std::vector<std::string> &paths, unsigned int count)
+{
+	std::vector<std::unique_ptr<cx88sdr::device>> ctls, devs;
+	uint64_t bytes = 0, chunks = 0, gap = 0, starved = 0, overruns = 0;
+	double t0, c0, wall, cpu;
+
+	try {
+		/* Start Position only affects handles opened after it is set */
+		if (opt.oldest) {
+			for (unsigned int i = 0; i < count; i++) {
+				ctls.push_back(std::make_unique<cx88sdr::device>(paths[i]));
+				ctls.back()->set_start_oldest(true);
+			}
+		}
+		for (unsigned int i = 0; i < count; i++)
+			devs.push_back(std::make_unique<cx88sdr::device>(paths[i]));
+
+		cx88sdr::reactor r(opt.block_size, opt.blocks);
+		/* Goes first, held blocks return to the reactor's pools */
+		std::vector<counters> cnt(count);
+
+		for (unsigned int i = 0; i < count; i++) {
+			r.add(*devs[i], [&cnt](const cx88sdr::chunk &c) {
+				counters &n = cnt[c.device];
+
+				n.chunks++;
+				n.gap += c.gap;
+				/* Touch the data once, like any consumer */
+				for (size_t j = 0; j < c.bytes.size(); j += 64)
+					n.sum += c.bytes[j];
+				if (opt.retain) {
+					if (n.held.size() == opt.retain)
+						n.held.pop_front();
+					n.held.push_back(c.retain());
+				}
+			});
+		}
+
+		t0 = wall_time();
+		c0 = cpu_time();
+		while (r.active() && wall_time() - t0 < opt.seconds)
+			r.run_once(100);
+		wall = wall_time() - t0;
+		cpu = cpu_time() - c0;
+
+		for (unsigned int i = 0; i < count; i++) {
+			bytes += r.bytes(i);
+			starved += r.starved(i);
+			chunks += cnt[i].chunks;
+			gap += cnt[i].gap;
+		}
+	} catch (const cx88sdr::error &e) {
+		std::fprintf(stderr, "%s: %s\n", e.what(), e.code().message().c_str());
+		return -1;
+	}
+
+	/* Device-wide counter, one reading per card is enough */
+	for (unsigned int i = 0; i < count; i++) {
+		bool seen = false;
+
+		for (unsigned int j = 0; j < i; j++)
+			seen |= paths[j] == paths[i];
+		if (!seen)
+			overruns += devs[i]->get(cx88sdr::counter::overruns);
+	}
+
+	std::printf("%2u  %9.1f  %7.3f  %8.1f  %9" PRIu64 "  %7" PRIu64 "  %10" PRIu64 "  %8" PRIu64 "\n",
+		    count, bytes / wall / 1e6, bytes ? cpu * 1e9 / bytes : 0.0,
+		    cpu / wall * 100.0, chunks, starved, gap, overruns);
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	std::fprintf(stderr,
+		"Usage: %s [options] <device...>\n"
+		"  -b <kib>   Block size in KiB (default %zu)\n"
+		"  -n <num>   Blocks per device (default %u)\n"
+		"  -r <num>   Chunks held per device, 0 holds none (default %u)\n"
+		"  -t <sec>   Duration of every step (default %.1f)\n"
+		"  -o         Start at the oldest data, measures the copy path\n"
+		"Up to %u devices, the same one may be repeated.\n",
+		prog, opt.block_size >> 10, opt.blocks, opt.retain, opt.seconds,
+		max_devices);
+}
+
+int main(int argc, char **argv)
+{
+	std::vector<std::string> paths;
+	unsigned int count;
+	int c;
+
+	while ((c = getopt(argc, argv, "b:n:r:t:oh")) != -1) {
+		switch (c) {
+		case 'b':
+			opt.block_size = std::strtoul(optarg, nullptr, 0) << 10;
+			break;
+		case 'n':
+			opt.blocks = std::strtoul(optarg, nullptr, 0);
+			break;
+		case 'r':
+			opt.retain = std::strtoul(optarg, nullptr, 0);
+			break;
+		case 't':
+			opt.seconds = std::strtod(optarg, nullptr);
+			break;
+		case 'o':
+			opt.oldest = true;
+			break;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	/* One block is always being filled */
+	if (optind >= argc || argc - optind > (int)max_devices || !opt.block_size ||
+	    opt.blocks < 2 || opt.retain >= opt.blocks || opt.seconds <= 0.0) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	paths.assign(argv + optind, argv + argc);
+
+	std::printf("devs      MB/s     ns/B     CPU%%     chunks  starved     skipped  overruns\n");
+	for (count = 1;; count *= 2) {
+		if (count > paths.size())
+			count = paths.size();
+		if (run(paths, count))
+			return EXIT_FAILURE;
+		if (count == paths.size())
+			break;
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,250 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (c) 2020 Jorge Maidana <jorgem.seq@gmail.com>
+ *
+ * C++ client library for cx88_sdr cards: typed device handles and a
+ * reactor that serves many /dev/swradioN nodes from one thread.
+ *
+ * Samples are handed out as non-owning views into blocks of a per-device
+ * pool that is allocated once. A view is only valid inside the callback,
+ * retain() keeps its block out of the pool until the returned reference
+ * goes away, from any thread, even after the reactor. Nothing on the read
+ * path allocates.
+ *
+ * The driver only implements read(), so blocks are always filled by a copy.
+ * device::can_stream() tells when a driver offers mmap streaming.
+ */
+
+#ifndef CX88SDR_HPP
+#define CX88SDR_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <sys/types.h>
+
+#include "cx88_sdr_uapi.h"
+
+namespace cx88sdr {
+
+/* A minimal std::span for C++17 */
+template <class T>
+class span {
+public:
+	constexpr span() noexcept = default;
+	constexpr span(T *data, size_t size) noexcept : data_(data), size_(size) {}
+
+	constexpr T *data() const noexcept { return data_; }
+	constexpr size_t size() const noexcept { return size_; }
+	constexpr size_t size_bytes() const noexcept { return size_ * sizeof(T); }
+	constexpr bool empty() const noexcept { return !size_; }
+	constexpr T *begin() const noexcept { return data_; }
+	constexpr T *end() const noexcept { return data_ + size_; }
+	constexpr T &operator[](size_t i) const noexcept { return data_[i]; }
+
+	constexpr span subspan(size_t offset, size_t count) const noexcept
+	{
+		return span(data_ + offset, count);
+	}
+
+private:
+	T	*data_ = nullptr;
+	size_t	size_ = 0;
+};
+
+enum class format : uint32_t {
+	ru8	= V4L2_SDR_FMT_RU8,
+	ru16le	= V4L2_SDR_FMT_RU16LE,
+	cs8	= V4L2_SDR_FMT_CS8,
+	cs16le	= V4L2_SDR_FMT_CS16LE,
+};
+
+/* Bytes per real sample or I/Q pair */
+size_t sample_size(format fmt) noexcept;
+bool is_complex(format fmt) noexcept;
+const char *format_name(format fmt) noexcept;
+/* "ru8", "ru16", "cs8", "cs16", false if unknown */
+bool parse_format(const std::string &name, format &fmt) noexcept;
+
+/* Read-only 64-bit counters */
+enum class counter : uint32_t {
+	skipped		= V4L2_CID_CX88SDR_SKIPPED,	/* Bytes, this handle */
+	overflows	= V4L2_CID_CX88SDR_OVERFLOWS,
+	errors		= V4L2_CID_CX88SDR_ERRORS,
+	recoveries	= V4L2_CID_CX88SDR_RECOVERIES,
+	overruns	= V4L2_CID_CX88SDR_OVERRUNS,
+};
+
+/* A setup ioctl failed, errno in code() */
+class error : public std::system_error {
+public:
+	error(int err, const std::string &what)
+		: std::system_error(err, std::generic_category(), what) {}
+};
+
+/* A driver event, only the member matching type is valid */
+struct event {
+	uint32_t	type;
+	union {
+		v4l2_event_cx88sdr_discontinuity	discontinuity;
+		v4l2_event_cx88sdr_reconfig		reconfig;
+		v4l2_event_cx88sdr_stats		stats;
+		v4l2_event_cx88sdr_recovery		recovery;
+	};
+};
+
+/*
+ * One open handle. Anything that is not a V4L2 SDR node (a FIFO, a capture
+ * file) is accepted as a plain RU8 source like the C tools do, setters are
+ * then ignored.
+ */
+class device {
+public:
+	explicit device(const std::string &path, bool nonblock = true);
+	~device();
+	device(device &&other) noexcept;
+	device &operator=(device &&other) noexcept;
+	device(const device &) = delete;
+	device &operator=(const device &) = delete;
+
+	int fd() const noexcept { return fd_; }
+	const std::string &path() const noexcept { return path_; }
+	bool is_v4l2() const noexcept { return is_v4l2_; }
+	/* V4L2_CAP_STREAMING, the driver only offers read() so far */
+	bool can_stream() const noexcept { return can_stream_; }
+
+	format get_format() const noexcept { return format_; }
+	void set_format(format fmt);
+	/* Samples or I/Q pairs per second of this handle */
+	uint32_t rate() const noexcept { return rate_; }
+	void set_rate(uint32_t rate);
+	/* The rates of the current format, from the driver's bands */
+	std::vector<uint32_t> rates() const;
+
+	int gain() const;
+	void set_gain(int gain);
+	int input() const;
+	void set_input(int input);
+	void set_max_latency(uint32_t usec);
+	/* Applies to handles opened afterwards */
+	void set_start_oldest(bool oldest);
+	int64_t get(counter c) const;
+
+	void subscribe(uint32_t type);
+	/* False once the queue is empty */
+	bool dequeue(event &ev);
+
+	/* Plain read(), -errno on failure */
+	ssize_t read(void *buf, size_t len) noexcept;
+
+private:
+	void query();
+	void set_ctrl(uint32_t id, int32_t val);
+	int32_t get_ctrl(uint32_t id) const;
+
+	int		fd_ = -1;
+	std::string	path_;
+	bool		is_v4l2_ = false;
+	bool		can_stream_ = false;
+	format		format_ = format::ru8;
+	uint32_t	rate_ = 28636363;
+};
+
+class block;
+
+/* Keeps a block out of its pool, movable and safe to drop on any thread */
+class block_ref {
+public:
+	block_ref() noexcept = default;
+	explicit block_ref(block *blk) noexcept;
+	~block_ref();
+	block_ref(block_ref &&other) noexcept : blk_(other.blk_) { other.blk_ = nullptr; }
+	block_ref &operator=(block_ref &&other) noexcept;
+	block_ref(const block_ref &) = delete;
+	block_ref &operator=(const block_ref &) = delete;
+
+	explicit operator bool() const noexcept { return blk_; }
+	void reset() noexcept;
+
+private:
+	block	*blk_ = nullptr;
+};
+
+/* Contiguous bytes of one device, no data was skipped inside */
+struct chunk {
+	unsigned int		device;		/* Index in the reactor */
+	format			fmt;
+	uint64_t		offset;		/* Stream offset, counts skipped bytes */
+	uint64_t		gap;		/* Bytes skipped right before it */
+	span<const uint8_t>	bytes;
+	block			*blk;
+
+	template <class T>
+	span<const T> samples() const noexcept
+	{
+		return span<const T>(reinterpret_cast<const T *>(bytes.data()),
+				     bytes.size() / sizeof(T));
+	}
+
+	block_ref retain() const noexcept { return block_ref(blk); }
+};
+
+class reactor {
+public:
+	using chunk_handler = std::function<void(const chunk &)>;
+	using event_handler = std::function<void(unsigned int device, const event &)>;
+
+	/* Every device gets blocks_per_device blocks of block_size bytes */
+	explicit reactor(size_t block_size = 256 << 10, unsigned int blocks_per_device = 8);
+	~reactor();
+	reactor(const reactor &) = delete;
+	reactor &operator=(const reactor &) = delete;
+
+	/*
+	 * The device must outlive the reactor and be nonblocking. Chunks end at
+	 * block boundaries and where the driver skipped data. on_event gets every
+	 * event the device was subscribed to, discontinuities are subscribed here.
+	 * Returns the index passed to the handlers.
+	 */
+	unsigned int add(device &dev, chunk_handler on_chunk, event_handler on_event = {});
+
+	/* Waits up to timeout_ms, -1 for ever. False once stopped. */
+	bool run_once(int timeout_ms = -1);
+	void run();
+	/* From any thread or a handler */
+	void stop() noexcept;
+
+	/* Devices that did not reach end of file yet */
+	unsigned int active() const noexcept;
+	/* Bytes read so far by device i */
+	uint64_t bytes(unsigned int i) const noexcept;
+	/* Times device i found its pool empty and had to wait */
+	uint64_t starved(unsigned int i) const noexcept;
+
+private:
+	struct stream;
+
+	void service(stream &st);
+	void read_some(stream &st);
+	void drain_events(stream &st);
+	void emit(stream &st, size_t end, uint64_t gap);
+	void arm(stream &st, bool read);
+
+	size_t					block_size_;
+	unsigned int				blocks_per_device_;
+	int					epfd_ = -1;
+	int					wakefd_ = -1;
+	std::atomic<bool>			stopped_{false};
+	std::vector<std::unique_ptr<stream>>	streams_;
+	std::vector<stream *>			polled_;	/* Plain files, always ready */
+};
+
+} // namespace cx88sdr
+
+#endif
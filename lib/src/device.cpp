@@ -0,0 +1,322 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (c) 2020 Jorge Maidana <jorgem.seq@gmail.com>
+ */
+
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include "cx88sdr/cx88sdr.hpp"
+
+namespace cx88sdr {
+
+static const struct {
+	const char	*name;
+	format		fmt;
+} formats[] = {
+	{ "ru8",	format::ru8 },
+	{ "ru16",	format::ru16le },
+	{ "cs8",	format::cs8 },
+	{ "cs16",	format::cs16le },
+};
+
+size_t sample_size(format fmt) noexcept
+{
+	switch (fmt) {
+	case format::ru16le:
+	case format::cs8:
+		return 2;
+	case format::cs16le:
+		return 4;
+	default:
+		return 1;
+	}
+}
+
+bool is_complex(format fmt) noexcept
+{
+	return fmt == format::cs8 || fmt == format::cs16le;
+}
+
+const char *format_name(format fmt) noexcept
+{
+	for (const auto &f : formats)
+		if (f.fmt == fmt)
+			return f.name;
+	return "unknown";
+}
+
+bool parse_format(const std::string &name, format &fmt) noexcept
+{
+	for (const auto &f : formats) {
+		if (name == f.name) {
+			fmt = f.fmt;
+			return true;
+		}
+	}
+	return false;
+}
+
+static int xioctl(int fd, unsigned long req, void *arg)
+{
+	int ret;
+
+	do {
+		ret = ioctl(fd, req, arg);
+	} while (ret < 0 && errno == EINTR);
+	return ret;
+}
+
+device::device(const std::string &path, bool nonblock) : path_(path)
+{
+	struct v4l2_capability cap;
+
+	fd_ = ::open(path.c_str(), O_RDONLY | O_CLOEXEC | (nonblock ? O_NONBLOCK : 0));
+	if (fd_ < 0)
+		throw error(errno, path);
+
+	std::memset(&cap, 0, sizeof(cap));
+	if (xioctl(fd_, VIDIOC_QUERYCAP, &cap) < 0)
+		return;
+
+	if (!(cap.device_caps & V4L2_CAP_SDR_CAPTURE)) {
+		::close(fd_);
+		fd_ = -1;
+		throw error(ENODEV, path + ": not an SDR capture device");
+	}
+	is_v4l2_ = true;
+	can_stream_ = cap.device_caps & V4L2_CAP_STREAMING;
+
+	try {
+		query();
+	} catch (...) {
+		::close(fd_);
+		fd_ = -1;
+		throw;
+	}
+}
+
+device::~device()
+{
+	if (fd_ >= 0)
+		::close(fd_);
+}
+
+device::device(device &&other) noexcept
+	: fd_(other.fd_), path_(std::move(other.path_)), is_v4l2_(other.is_v4l2_),
+	  can_stream_(other.can_stream_), format_(other.format_), rate_(other.rate_)
+{
+	other.fd_ = -1;
+}
+
+device &device::operator=(device &&other) noexcept
+{
+	if (this != &other) {
+		if (fd_ >= 0)
+			::close(fd_);
+		fd_ = other.fd_;
+		path_ = std::move(other.path_);
+		is_v4l2_ = other.is_v4l2_;
+		can_stream_ = other.can_stream_;
+		format_ = other.format_;
+		rate_ = other.rate_;
+		other.fd_ = -1;
+	}
+	return *this;
+}
+
+void device::query()
+{
+	struct v4l2_format fmt;
+	struct v4l2_frequency freq;
+
+	std::memset(&fmt, 0, sizeof(fmt));
+	fmt.type = V4L2_BUF_TYPE_SDR_CAPTURE;
+	if (xioctl(fd_, VIDIOC_G_FMT, &fmt) < 0)
+		throw error(errno, path_ + ": VIDIOC_G_FMT");
+	format_ = static_cast<format>(fmt.fmt.sdr.pixelformat);
+
+	std::memset(&freq, 0, sizeof(freq));
+	if (xioctl(fd_, VIDIOC_G_FREQUENCY, &freq) < 0)
+		throw error(errno, path_ + ": VIDIOC_G_FREQUENCY");
+	rate_ = freq.frequency;
+}
+
+void device::set_format(format fmt)
+{
+	struct v4l2_format f;
+
+	if (!is_v4l2_) {
+		format_ = fmt;
+		return;
+	}
+
+	std::memset(&f, 0, sizeof(f));
+	f.type = V4L2_BUF_TYPE_SDR_CAPTURE;
+	f.fmt.sdr.pixelformat = static_cast<uint32_t>(fmt);
+	if (xioctl(fd_, VIDIOC_S_FMT, &f) < 0)
+		throw error(errno, path_ + ": VIDIOC_S_FMT");
+	if (f.fmt.sdr.pixelformat != static_cast<uint32_t>(fmt))
+		throw error(EINVAL, path_ + ": format not supported");
+
+	/* The bands follow the sample width */
+	query();
+}
+
+void device::set_rate(uint32_t rate)
+{
+	struct v4l2_frequency freq;
+
+	if (!is_v4l2_) {
+		rate_ = rate;
+		return;
+	}
+
+	std::memset(&freq, 0, sizeof(freq));
+	freq.type = V4L2_TUNER_SDR;
+	freq.frequency = rate;
+	if (xioctl(fd_, VIDIOC_S_FREQUENCY, &freq) < 0)
+		throw error(errno, path_ + ": VIDIOC_S_FREQUENCY");
+	query();
+}
+
+std::vector<uint32_t> device::rates() const
+{
+	std::vector<uint32_t> rates;
+	struct v4l2_frequency_band band;
+
+	if (!is_v4l2_)
+		return { rate_ };
+
+	for (uint32_t i = 0;; i++) {
+		std::memset(&band, 0, sizeof(band));
+		band.type = V4L2_TUNER_SDR;
+		band.index = i;
+		if (xioctl(fd_, VIDIOC_ENUM_FREQ_BANDS, &band) < 0)
+			break;
+		rates.push_back(band.rangelow);
+	}
+	return rates;
+}
+
+void device::set_ctrl(uint32_t id, int32_t val)
+{
+	struct v4l2_control ctrl;
+
+	if (!is_v4l2_)
+		return;
+
+	ctrl.id = id;
+	ctrl.value = val;
+	if (xioctl(fd_, VIDIOC_S_CTRL, &ctrl) < 0)
+		throw error(errno, path_ + ": VIDIOC_S_CTRL");
+}
+
+int32_t device::get_ctrl(uint32_t id) const
+{
+	struct v4l2_control ctrl;
+
+	if (!is_v4l2_)
+		throw error(ENOTTY, path_ + ": not a V4L2 device");
+
+	ctrl.id = id;
+	ctrl.value = 0;
+	if (xioctl(fd_, VIDIOC_G_CTRL, &ctrl) < 0)
+		throw error(errno, path_ + ": VIDIOC_G_CTRL");
+	return ctrl.value;
+}
+
+int device::gain() const
+{
+	return get_ctrl(V4L2_CID_GAIN);
+}
+
+void device::set_gain(int gain)
+{
+	set_ctrl(V4L2_CID_GAIN, gain);
+}
+
+int device::input() const
+{
+	return get_ctrl(V4L2_CID_CX88SDR_INPUT);
+}
+
+void device::set_input(int input)
+{
+	set_ctrl(V4L2_CID_CX88SDR_INPUT, input);
+}
+
+void device::set_max_latency(uint32_t usec)
+{
+	set_ctrl(V4L2_CID_CX88SDR_MAX_LATENCY, usec);
+}
+
+void device::set_start_oldest(bool oldest)
+{
+	set_ctrl(V4L2_CID_CX88SDR_START, oldest);
+}
+
+int64_t device::get(counter c) const
+{
+	struct v4l2_ext_controls ctrls;
+	struct v4l2_ext_control ctrl;
+	uint32_t id = static_cast<uint32_t>(c);
+
+	if (!is_v4l2_)
+		return 0;
+
+	std::memset(&ctrls, 0, sizeof(ctrls));
+	std::memset(&ctrl, 0, sizeof(ctrl));
+	ctrl.id = id;
+	ctrls.which = V4L2_CTRL_ID2WHICH(id);
+	ctrls.count = 1;
+	ctrls.controls = &ctrl;
+	if (xioctl(fd_, VIDIOC_G_EXT_CTRLS, &ctrls) < 0)
+		throw error(errno, path_ + ": VIDIOC_G_EXT_CTRLS");
+	return ctrl.value64;
+}
+
+void device::subscribe(uint32_t type)
+{
+	struct v4l2_event_subscription sub;
+
+	if (!is_v4l2_)
+		return;
+
+	std::memset(&sub, 0, sizeof(sub));
+	sub.type = type;
+	if (xioctl(fd_, VIDIOC_SUBSCRIBE_EVENT, &sub) < 0)
+		throw error(errno, path_ + ": VIDIOC_SUBSCRIBE_EVENT");
+}
+
+bool device::dequeue(event &ev)
+{
+	struct v4l2_event v;
+
+	if (!is_v4l2_)
+		return false;
+
+	if (xioctl(fd_, VIDIOC_DQEVENT, &v) < 0) {
+		if (errno == ENOENT)
+			return false;
+		throw error(errno, path_ + ": VIDIOC_DQEVENT");
+	}
+
+	ev.type = v.type;
+	static_assert(sizeof(ev.recovery) <= sizeof(v.u.data), "event too large");
+	std::memcpy(&ev.discontinuity, v.u.data, sizeof(ev) - offsetof(event, discontinuity));
+	return true;
+}
+
+ssize_t device::read(void *buf, size_t len) noexcept
+{
+	ssize_t ret = ::read(fd_, buf, len);
+
+	return ret < 0 ? -errno : ret;
+}
+
+} // namespace cx88sdr
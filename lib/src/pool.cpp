@@ -0,0 +1,104 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (c) 2020 Jorge Maidana <jorgem.seq@gmail.com>
+ */
+
+#include <cerrno>
+#include <cstdlib>
+#include <new>
+
+#include "cx88sdr/cx88sdr.hpp"
+#include "pool.hpp"
+
+namespace cx88sdr {
+
+static constexpr size_t page_size = 4096;
+
+pool::pool(size_t block_size, unsigned int count) : blocks_(count)
+{
+	size_t size = (block_size + page_size - 1) / page_size * page_size;
+
+	mem_ = static_cast<uint8_t *>(std::aligned_alloc(page_size, size * count));
+	if (!mem_)
+		throw std::bad_alloc();
+
+	free_.reserve(count);
+	for (unsigned int i = 0; i < count; i++) {
+		blocks_[i].data = mem_ + i * size;
+		blocks_[i].owner = this;
+		free_.push_back(&blocks_[count - 1 - i]);
+	}
+}
+
+pool::~pool()
+{
+	std::free(mem_);
+}
+
+void pool::put() noexcept
+{
+	if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		delete this;
+}
+
+block *pool::acquire() noexcept
+{
+	std::lock_guard<std::mutex> guard(lock_);
+	block *blk;
+
+	if (free_.empty())
+		return nullptr;
+	blk = free_.back();
+	free_.pop_back();
+	blk->refs.store(1, std::memory_order_relaxed);
+	refs_.fetch_add(1, std::memory_order_relaxed);
+	return blk;
+}
+
+bool pool::empty() noexcept
+{
+	std::lock_guard<std::mutex> guard(lock_);
+
+	return free_.empty();
+}
+
+void pool::release(block *blk) noexcept
+{
+	{
+		std::lock_guard<std::mutex> guard(lock_);
+
+		free_.push_back(blk);
+	}
+	/* Last, this may free the pool */
+	put();
+}
+
+block_ref::block_ref(block *blk) noexcept : blk_(blk)
+{
+	if (blk_)
+		blk_->get();
+}
+
+block_ref::~block_ref()
+{
+	reset();
+}
+
+block_ref &block_ref::operator=(block_ref &&other) noexcept
+{
+	if (this != &other) {
+		reset();
+		blk_ = other.blk_;
+		other.blk_ = nullptr;
+	}
+	return *this;
+}
+
+void block_ref::reset() noexcept
+{
+	if (blk_)
+		blk_->put();
+	blk_ = nullptr;
+}
+
+} // namespace cx88sdr
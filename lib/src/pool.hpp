@@ -0,0 +1,67 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (c) 2020 Jorge Maidana <jorgem.seq@gmail.com>
+ *
+ * Fixed pool of page aligned sample blocks, allocated once per device.
+ * The creator and every block out of the pool hold a reference to it, so
+ * retained blocks stay valid after the creator let go.
+ */
+
+#ifndef CX88SDR_POOL_HPP
+#define CX88SDR_POOL_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace cx88sdr {
+
+class pool;
+
+class block {
+public:
+	uint8_t			*data = nullptr;
+	std::atomic<int>	refs{0};
+	pool			*owner = nullptr;
+
+	void get() noexcept { refs.fetch_add(1, std::memory_order_relaxed); }
+	void put() noexcept;
+};
+
+class pool {
+public:
+	/* With one reference held by the caller */
+	pool(size_t block_size, unsigned int count);
+	pool(const pool &) = delete;
+	pool &operator=(const pool &) = delete;
+
+	/* Drops a reference, the last one frees the pool */
+	void put() noexcept;
+
+	/* With one reference held by the caller, nullptr while all are out */
+	block *acquire() noexcept;
+	bool empty() noexcept;
+
+private:
+	friend class block;
+	~pool();
+	void release(block *blk) noexcept;
+
+	std::atomic<unsigned int>	refs_{1};
+	uint8_t			*mem_;
+	std::vector<block>	blocks_;
+	std::mutex		lock_;
+	std::vector<block *>	free_;		/* Never grows past its reserve */
+};
+
+inline void block::put() noexcept
+{
+	if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		owner->release(this);
+}
+
+} // namespace cx88sdr
+
+#endif
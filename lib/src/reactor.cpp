@@ -0,0 +1,343 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (c) 2020 Jorge Maidana <jorgem.seq@gmail.com>
+ *
+ * One epoll set for all devices. Every device fills the block at the head of
+ * its pool and hands out a chunk whenever the block is full or the driver
+ * skipped data, so chunks are always contiguous in the stream.
+ */
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "cx88sdr/cx88sdr.hpp"
+#include "pool.hpp"
+
+namespace cx88sdr {
+
+/* Reads per device and wakeup, so one busy card can't starve the rest */
+static constexpr unsigned int max_reads = 4;
+/* The driver queues 32 events of a type */
+static constexpr unsigned int max_gaps = 64;
+static constexpr int max_ready = 64;
+/* How often a device without free blocks looks for a release */
+static constexpr int starved_ms = 5;
+
+struct reactor::stream {
+	stream(size_t block_size, unsigned int count) : blocks(new pool(block_size, count)) {}
+	stream(const stream &) = delete;
+	stream &operator=(const stream &) = delete;
+
+	/* Blocks still retained keep the pool alive */
+	~stream()
+	{
+		if (cur)
+			cur->put();
+		blocks->put();
+	}
+
+	device		*dev;
+	unsigned int	index;
+	chunk_handler	on_chunk;
+	event_handler	on_event;
+	pool		*blocks;
+	bool		plain = false;		/* Not pollable, always tried */
+	bool		reading = true;		/* EPOLLIN armed */
+	bool		done = false;
+
+	block		*cur = nullptr;
+	size_t		fill = 0;		/* Bytes in cur */
+	size_t		emitted = 0;		/* Bytes of cur handed out */
+	uint64_t	base = 0;		/* Bytes read before cur */
+	uint64_t	skipped = 0;		/* Skipped before cur->data[emitted] */
+	uint64_t	gap = 0;		/* Right before cur->data[emitted] */
+
+	/* Where data resumes in read bytes, and the bytes skipped there */
+	std::array<std::pair<uint64_t, uint64_t>, max_gaps> gaps;
+	unsigned int	gap_head = 0;
+	unsigned int	gap_count = 0;
+	uint64_t	gap_total = 0;		/* Of all queued discontinuities */
+
+	uint64_t	bytes = 0;
+	uint64_t	starved = 0;
+};
+
+reactor::reactor(size_t block_size, unsigned int blocks_per_device)
+	: block_size_(block_size), blocks_per_device_(std::max(blocks_per_device, 2u))
+{
+	struct epoll_event ev = {};
+
+	epfd_ = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd_ < 0)
+		throw error(errno, "epoll_create1");
+
+	wakefd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (wakefd_ < 0) {
+		int err = errno;
+
+		::close(epfd_);
+		throw error(err, "eventfd");
+	}
+
+	ev.events = EPOLLIN;
+	ev.data.ptr = nullptr;
+	if (epoll_ctl(epfd_, EPOLL_CTL_ADD, wakefd_, &ev) < 0) {
+		int err = errno;
+
+		::close(wakefd_);
+		::close(epfd_);
+		throw error(err, "epoll_ctl");
+	}
+}
+
+reactor::~reactor()
+{
+	::close(wakefd_);
+	::close(epfd_);
+}
+
+unsigned int reactor::add(device &dev, chunk_handler on_chunk, event_handler on_event)
+{
+	auto st = std::make_unique<stream>(block_size_, blocks_per_device_);
+	struct epoll_event ev = {};
+
+	st->dev = &dev;
+	st->index = streams_.size();
+	st->on_chunk = std::move(on_chunk);
+	st->on_event = std::move(on_event);
+
+	/* Chunk offsets depend on it */
+	dev.subscribe(V4L2_EVENT_CX88SDR_DISCONTINUITY);
+
+	ev.events = EPOLLIN | EPOLLPRI;
+	ev.data.ptr = st.get();
+	if (epoll_ctl(epfd_, EPOLL_CTL_ADD, dev.fd(), &ev) < 0) {
+		/* Regular files can't be polled, they are always ready */
+		if (errno != EPERM)
+			throw error(errno, dev.path() + ": epoll_ctl");
+		st->plain = true;
+		polled_.push_back(st.get());
+	}
+
+	streams_.push_back(std::move(st));
+	return streams_.size() - 1;
+}
+
+void reactor::arm(stream &st, bool read)
+{
+	struct epoll_event ev = {};
+
+	st.reading = read;
+	if (st.plain)
+		return;
+
+	ev.events = read ? EPOLLIN | EPOLLPRI : EPOLLPRI;
+	ev.data.ptr = &st;
+	epoll_ctl(epfd_, EPOLL_CTL_MOD, st.dev->fd(), &ev);
+}
+
+/* Hand out cur->data[emitted, end) */
+void reactor::emit(stream &st, size_t end, uint64_t gap)
+{
+	chunk c;
+
+	if (end > st.emitted) {
+		c.device = st.index;
+		c.fmt = st.dev->get_format();
+		c.offset = st.base + st.emitted + st.skipped;
+		c.gap = st.gap;
+		c.bytes = span<const uint8_t>(st.cur->data + st.emitted, end - st.emitted);
+		c.blk = st.cur;
+		st.on_chunk(c);
+		st.emitted = end;
+		st.gap = 0;
+	}
+	st.gap += gap;
+	st.skipped += gap;
+}
+
+void reactor::drain_events(stream &st)
+{
+	event ev;
+
+	while (st.dev->dequeue(ev)) {
+		if (ev.type == V4L2_EVENT_CX88SDR_DISCONTINUITY) {
+			/* The data resumes at offset minus everything skipped so far */
+			st.gap_total += ev.discontinuity.skipped;
+			if (st.gap_count < max_gaps) {
+				st.gaps[(st.gap_head + st.gap_count++) % max_gaps] = {
+					ev.discontinuity.offset - st.gap_total,
+					ev.discontinuity.skipped
+				};
+			} else {
+				/*
+				 * Full, the skip is reported at the last queued gap.
+				 * Offsets are right again once the data passes it.
+				 */
+				st.gaps[(st.gap_head + max_gaps - 1) % max_gaps].second +=
+					ev.discontinuity.skipped;
+			}
+		}
+		if (st.on_event)
+			st.on_event(st.index, ev);
+	}
+}
+
+void reactor::read_some(stream &st)
+{
+	for (unsigned int i = 0; i < max_reads; i++) {
+		ssize_t n;
+
+		if (!st.cur) {
+			st.cur = st.blocks->acquire();
+			if (!st.cur) {
+				/* Everything is retained, wait for a release */
+				st.starved++;
+				arm(st, false);
+				return;
+			}
+			st.fill = st.emitted = 0;
+		}
+
+		n = st.dev->read(st.cur->data + st.fill, block_size_ - st.fill);
+		if (n == -EINTR)
+			continue;
+		if (n == -EAGAIN)
+			break;
+		if (n <= 0) {
+			/* End of a file or FIFO, or the device went away */
+			emit(st, st.fill, 0);
+			st.done = true;
+			if (!st.plain)
+				epoll_ctl(epfd_, EPOLL_CTL_DEL, st.dev->fd(), nullptr);
+			return;
+		}
+		st.fill += n;
+		st.bytes += n;
+
+		/* Skips inside the new bytes are queued by now, cut the chunks there */
+		drain_events(st);
+		while (st.gap_count) {
+			auto gap = st.gaps[st.gap_head];
+
+			if (gap.first > st.base + st.fill)
+				break;
+			emit(st, std::max(gap.first, st.base + st.emitted) - st.base, gap.second);
+			st.gap_head = (st.gap_head + 1) % max_gaps;
+			st.gap_count--;
+		}
+
+		if (st.fill == block_size_) {
+			emit(st, st.fill, 0);
+			st.cur->put();
+			st.cur = nullptr;
+			st.base += block_size_;
+		}
+	}
+}
+
+void reactor::service(stream &st)
+{
+	if (st.done)
+		return;
+	if (st.reading)
+		read_some(st);
+	else
+		drain_events(st);
+}
+
+bool reactor::run_once(int timeout_ms)
+{
+	struct epoll_event ready[max_ready];
+	bool busy = false, starving = false;
+	int n, i;
+
+	if (stopped_.load(std::memory_order_relaxed))
+		return false;
+
+	/* Released blocks let starved devices read again */
+	for (auto &st : streams_) {
+		if (st->done)
+			continue;
+		if (!st->reading) {
+			if (st->blocks->empty())
+				starving = true;
+			else
+				arm(*st, true);
+		}
+		if (st->plain)
+			busy = true;
+	}
+	if (busy)
+		timeout_ms = 0;
+	else if (starving && (timeout_ms < 0 || timeout_ms > starved_ms))
+		timeout_ms = starved_ms;
+
+	n = epoll_wait(epfd_, ready, max_ready, timeout_ms);
+	if (n < 0 && errno != EINTR)
+		throw error(errno, "epoll_wait");
+
+	for (i = 0; i < n; i++) {
+		stream *st = static_cast<stream *>(ready[i].data.ptr);
+
+		/* Only stop() writes the eventfd, the flag says the rest */
+		if (!st) {
+			uint64_t val;
+			ssize_t ret = ::read(wakefd_, &val, sizeof(val));
+
+			(void)ret;
+			continue;
+		}
+		if (ready[i].events & EPOLLIN)
+			read_some(*st);
+		else
+			service(*st);
+	}
+
+	for (auto *st : polled_)
+		service(*st);
+
+	return !stopped_.load(std::memory_order_relaxed);
+}
+
+void reactor::run()
+{
+	while (run_once(-1))
+		;
+}
+
+void reactor::stop() noexcept
+{
+	uint64_t one = 1;
+	ssize_t ret;
+
+	stopped_.store(true, std::memory_order_relaxed);
+	ret = ::write(wakefd_, &one, sizeof(one));
+	(void)ret;
+}
+
+unsigned int reactor::active() const noexcept
+{
+	unsigned int n = 0;
+
+	for (const auto &st : streams_)
+		n += !st->done;
+	return n;
+}
+
+uint64_t reactor::bytes(unsigned int i) const noexcept
+{
+	return streams_[i]->bytes;
+}
+
+uint64_t reactor::starved(unsigned int i) const noexcept
+{
+	return streams_[i]->starved;
+}
+
+} // namespace cx88sdr
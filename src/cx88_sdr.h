@@ -23,18 +23,27 @@
 #include <media/v4l2-ctrls.h>
 #include <media/v4l2-device.h>
 
-/* Real formats */
-#ifndef V4L2_SDR_FMT_RU8
-#define V4L2_SDR_FMT_RU8		V4L2_SDR_FMT_CU8
-#endif
-#ifndef V4L2_SDR_FMT_RU16LE
-#define V4L2_SDR_FMT_RU16LE		V4L2_SDR_FMT_CU16LE
-#endif
+#include "cx88_sdr_uapi.h"
 
 #define CX88SDR_DRV_NAME		"CX2388x SDR"
 #define CX88SDR_MAX_CARDS		32
 
-#define INTERRUPT_MASK			0x018888
+#define INTERRUPT_VBI_RISCI1		(1 << 3)
+#define INTERRUPT_VBI_RISCI2		(1 << 7)
+#define INTERRUPT_VBI_OFLOW		(1 << 11)
+#define INTERRUPT_VBI_SYNC		(1 << 15)
+#define INTERRUPT_OPC_ERR		(1 << 16)
+#define INTERRUPT_PAR_ERR		(1 << 17)
+#define INTERRUPT_RIP_ERR		(1 << 18)
+#define INTERRUPT_PCI_ABORT		(1 << 19)
+#define INTERRUPT_ERRORS		(INTERRUPT_OPC_ERR | INTERRUPT_PAR_ERR | \
+					 INTERRUPT_RIP_ERR | INTERRUPT_PCI_ABORT)
+/* The RISC engine stops on these */
+#define INTERRUPT_FATAL			(INTERRUPT_OPC_ERR | INTERRUPT_RIP_ERR | \
+					 INTERRUPT_PCI_ABORT)
+#define INTERRUPT_MASK			(INTERRUPT_VBI_RISCI1 | INTERRUPT_VBI_RISCI2 | \
+					 INTERRUPT_VBI_OFLOW | INTERRUPT_VBI_SYNC | \
+					 INTERRUPT_ERRORS)
 
 #define MO_DEV_CNTRL2			0x200034 // Device control
 #define MO_PCI_INTMSK			0x200040 // PCI interrupt mask
@@ -44,6 +53,7 @@
 #define MO_DMA24_CNT1			0x30010c // {11}RW* DMA Buffer Size : Ch#24
 #define MO_DMA24_CNT2			0x30014c // {11}RW* DMA Table Size : Ch#24
 #define MO_VBI_GPCNT			0x31c02c // {16}RO VBI general purpose counter
+#define MO_VBI_GPCNTRL			0x31c030 // {2}WO VBI general purpose control
 #define MO_VID_DMACNTRL			0x31c040 // {8}RW Video DMA control
 #define MO_INPUT_FORMAT			0x310104
 #define MO_CONTR_BRIGHT			0x310110
@@ -73,18 +83,54 @@
 #define RISC_JUMP			0x70000000
 #define RISC_SYNC			0x80000000
 
+#define GP_COUNT_CONTROL_RESET		0x3
+
+/* SRAM FIFO layout, the defaults fill the cluster area */
+#define CLUSTER_BUF_AREA		SZ_16K
 #define CLUSTER_BUF_NUM			8
 #define CLUSTER_BUF_SIZE		SZ_2K
+#define CLUSTER_BUF_SIZE_MIN		256
+#define CLUSTER_BUF_SIZE_MAX		SZ_2K	/* RISC WRITE byte count is 12 bits */
 
 #define VBI_DMA_SIZE			SZ_64M
 #define VBI_DMA_PAGES			(VBI_DMA_SIZE >> PAGE_SHIFT)
-#define VBI_DMA_BUF_NUM			(VBI_DMA_SIZE / CLUSTER_BUF_SIZE)
+
+/* Pages between RISC IRQs, also the input scan granularity */
+#define CX88SDR_IRQ_PAGES		64
+
+/* Readers are woken by the RISC IRQ, this only guards against a lost one */
+#define CX88SDR_READ_TIMEOUT		(HZ / 4)
+
+/* A ring head that does not move for this long means the DMA stalled */
+#define CX88SDR_WATCHDOG		(HZ / 2)
+
+/* Restarts in a row without progress before giving up, the delay doubles each time */
+#define CX88SDR_RESTARTS		8
+
+/* Pages kept clear of the writer when starting at the oldest data */
+#define CX88SDR_RING_GUARD		512
+
+/* How far the writer may be ahead of the last head anyone read */
+#define CX88SDR_LAP_MARGIN		(2 * CX88SDR_IRQ_PAGES)
+
+/* Samples still queued in the SRAM clusters when registers change */
+#define CX88SDR_FIFO_PAGES(dev)		DIV_ROUND_UP((dev)->cluster_num * (dev)->cluster_size, \
+					     PAGE_SIZE)
+
+#define CX88SDR_EVENT_QUEUE_LEN		32
+
+/* Pages analyzed for the level statistics per RISC IRQ block */
+#define CX88SDR_STATS_PAGES		4
+
+/* Configuration changes remembered for the input filter, a power of 2 */
+#define CX88SDR_SEGMENTS		256
 
 enum {
 	CX88SDR_INPUT_00, /* Pin 145 */
 	CX88SDR_INPUT_01, /* Pin 144 */
 	CX88SDR_INPUT_02, /* Pin 143 */
 	CX88SDR_INPUT_03, /* Pin 142 */
+	CX88SDR_INPUTS,
 };
 
 #define CX88SDR_XTAL_FREQ		28636363
@@ -96,6 +142,17 @@ enum {
 	CX88SDR_BAND_02, /* 35795453 Hz (RU08), 17897726 Hz (RU16) */
 };
 
+/*
+ * Ring bytes [first, clean) are mixed, the segment holds input from clean on.
+ * After a DMA restart they were never written at all.
+ */
+struct cx88sdr_segment {
+	u64				first;
+	u64				clean;
+	u32				input;
+	bool				hole;
+};
+
 struct cx88sdr_dev {
 	unsigned int			irq;
 	int				nr;
@@ -108,17 +165,58 @@ struct cx88sdr_dev {
 	uint32_t	__iomem		*ctrl;
 	uint32_t			risc_buf_sz;
 	uint32_t			*risc_buf;
-	uint32_t			start_page;
 	void				*dma_buf_pages[VBI_DMA_PAGES + 1];
+	bool				dma_streaming;
+	bool				zero_read;
+	u32				cluster_num;
+	u32				cluster_size;
 	int				pci_lat;
+	const struct cpumask		*irq_hint;
+
+	/* Ring position, pages written since probe */
+	spinlock_t			ring_lock;
+	u64				ring_lap;
+	u64				ring_first;	/* First page written */
+	u32				ring_gpcnt;
+	atomic64_t			ring_seen;	/* Last cx88sdr_ring_head() */
+
+	/* Error counters and DMA recovery */
+	atomic64_t			overflows;
+	atomic64_t			overruns;
+	atomic64_t			errors;
+	atomic64_t			recoveries;
+	atomic_t			recover_status;
+	struct delayed_work		watchdog;
+	u64				watchdog_head;
+	u32				watchdog_fails;	/* Restarts without progress */
+	bool				running;
 
 	/* V4L2 */
 	struct	v4l2_device		v4l2_dev;
 	struct	v4l2_ctrl_handler	ctrl_handler;
 	struct	video_device		vdev;
 	struct	mutex			vdev_mlock;
+	wait_queue_head_t		read_wq;
+	struct list_head		fh_list;
+	spinlock_t			fh_lock;
+	int				users;
 	u32				gain;
 	u32				input;
+	u32				input_sel;
+	u32				start_oldest;
+
+	/* Configuration history and input scanning, input and scan state under seg_lock */
+	spinlock_t			seg_lock;
+	struct cx88sdr_segment		seg[CX88SDR_SEGMENTS];
+	u64				seg_cnt;
+	u32				scan_mask;
+	u32				scan_dwell;
+	u64				scan_next;
+
+	/* Level statistics, only computed while someone subscribes */
+	struct work_struct		stats_work;
+	atomic_t			stats_users;
+	u64				stats_head;
 
 	/* V4L2 SDR */
 	u32				sdr_band;
@@ -141,14 +239,42 @@ static inline void ctrl_iowrite32(struct cx88sdr_dev *dev, uint32_t reg, uint32_
 						pci_name(dev->pdev), ##__VA_ARGS__)
 #define cx88sdr_pr_err(fmt, ...)	pr_err(KBUILD_MODNAME " %s: " fmt,		\
 						pci_name(dev->pdev), ##__VA_ARGS__)
+#define cx88sdr_pr_err_ratelimited(fmt, ...)					\
+					pr_err_ratelimited(KBUILD_MODNAME " %s: " fmt,	\
+						pci_name(dev->pdev), ##__VA_ARGS__)
+#define cx88sdr_pr_warn_ratelimited(fmt, ...)					\
+					pr_warn_ratelimited(KBUILD_MODNAME " %s: " fmt,	\
+						pci_name(dev->pdev), ##__VA_ARGS__)
+
+/* cx88_sdr_core.c */
+u64 cx88sdr_ring_head(struct cx88sdr_dev *dev);
+
+/* The head without a register read, the RISC IRQ keeps it fresh */
+static inline u64 cx88sdr_ring_seen(struct cx88sdr_dev *dev)
+{
+	return atomic64_read(&dev->ring_seen);
+}
 
 /* cx88_sdr_v4l2.c */
 extern const struct v4l2_ctrl_ops cx88sdr_ctrl_ops;
 extern const struct v4l2_ctrl_config cx88sdr_ctrl_input;
+extern const struct v4l2_ctrl_config cx88sdr_ctrl_start;
+extern const struct v4l2_ctrl_config cx88sdr_ctrl_scan_inputs;
+extern const struct v4l2_ctrl_config cx88sdr_ctrl_scan_dwell;
+extern const struct v4l2_ctrl_config cx88sdr_ctrl_overflows;
+extern const struct v4l2_ctrl_config cx88sdr_ctrl_overruns;
+extern const struct v4l2_ctrl_config cx88sdr_ctrl_errors;
+extern const struct v4l2_ctrl_config cx88sdr_ctrl_recoveries;
 extern const struct video_device cx88sdr_template;
 
 int cx88sdr_adc_fmt_set(struct cx88sdr_dev *dev);
 void cx88sdr_agc_setup(struct cx88sdr_dev *dev);
 void cx88sdr_input_set(struct cx88sdr_dev *dev);
+int cx88sdr_reconfig(struct cx88sdr_dev *dev, bool adc);
+void cx88sdr_scan_step(struct cx88sdr_dev *dev, u64 head);
+void cx88sdr_stats_work(struct work_struct *work);
+void cx88sdr_queue_recovery(struct cx88sdr_dev *dev, u64 first, u64 clean,
+			    u32 status);
+void cx88sdr_queue_stopped(struct cx88sdr_dev *dev, u32 status);
 
 #endif
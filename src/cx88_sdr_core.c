@@ -19,8 +19,12 @@
 
 #include <linux/delay.h>
 #include <linux/interrupt.h>
+#include <linux/irq.h>
+#include <linux/log2.h>
 #include <linux/module.h>
 #include <linux/pci.h>
+#include <linux/topology.h>
+#include <linux/version.h>
 #include <linux/videodev2.h>
 #include <media/v4l2-dev.h>
 #include <media/v4l2-event.h>
@@ -36,7 +40,40 @@ static int latency = 248;
 module_param(latency, int, 0);
 MODULE_PARM_DESC(latency, "Set PCI latency timer");
 
-static int cx88sdr_devcount;
+static unsigned int cluster_num = CLUSTER_BUF_NUM;
+module_param(cluster_num, uint, 0444);
+MODULE_PARM_DESC(cluster_num, "Number of SRAM FIFO clusters (default 8)");
+
+static unsigned int cluster_size = CLUSTER_BUF_SIZE;
+module_param(cluster_size, uint, 0444);
+MODULE_PARM_DESC(cluster_size, "SRAM FIFO cluster size in bytes, 256 to 2048 (default 2048)");
+
+static bool dma_streaming;
+module_param(dma_streaming, bool, 0444);
+MODULE_PARM_DESC(dma_streaming, "Use cached pages with streaming DMA mappings for the ring");
+
+static bool zero_read;
+module_param(zero_read, bool, 0444);
+MODULE_PARM_DESC(zero_read, "Debug: zero the ring bytes read() copied, the old consumed marker, for A/B runs");
+
+static int irq_cpu[CX88SDR_MAX_CARDS] = { [0 ... CX88SDR_MAX_CARDS - 1] = -1 };
+module_param_array(irq_cpu, int, NULL, 0444);
+MODULE_PARM_DESC(irq_cpu, "CPU for the IRQ and reader wakeups per card number, -1 for the card's NUMA node (default)");
+
+/* Card numbers in use, a card keeps its number until it is removed */
+static DECLARE_BITMAP(cx88sdr_slots, CX88SDR_MAX_CARDS);
+
+static int cx88sdr_slot_get(void)
+{
+	int nr;
+
+	do {
+		nr = find_first_zero_bit(cx88sdr_slots, CX88SDR_MAX_CARDS);
+		if (nr >= CX88SDR_MAX_CARDS)
+			return -ENODEV;
+	} while (test_and_set_bit(nr, cx88sdr_slots));
+	return nr;
+}
 
 static void cx88sdr_pci_lat_set(struct cx88sdr_dev *dev)
 {
@@ -88,6 +125,12 @@ static void cx88sdr_sram_setup(struct cx88sdr_dev *dev, uint32_t buf_cnt,
 	ctrl_iowrite32(dev, MO_DMA24_CNT2, buf_cnt * 2);
 }
 
+static void cx88sdr_dma_start(struct cx88sdr_dev *dev)
+{
+	ctrl_iowrite32(dev, MO_DEV_CNTRL2, (1 << 5));
+	ctrl_iowrite32(dev, MO_VID_DMACNTRL, (1 << 7) | (1 << 3));
+}
+
 static void cx88sdr_adc_setup(struct cx88sdr_dev *dev)
 {
 	ctrl_iowrite32(dev, MO_VID_INTSTAT, ctrl_ioread32(dev, MO_VID_INTSTAT));
@@ -95,20 +138,36 @@ static void cx88sdr_adc_setup(struct cx88sdr_dev *dev)
 	ctrl_iowrite32(dev, MO_OUTPUT_FORMAT, 0xf);
 	ctrl_iowrite32(dev, MO_CONTR_BRIGHT, 0xff00);
 	ctrl_iowrite32(dev, MO_COLOR_CTRL, (0xe << 4) | 0xe);
-	ctrl_iowrite32(dev, MO_VBI_PACKET, (CLUSTER_BUF_SIZE << 17) | (2 << 11));
+	ctrl_iowrite32(dev, MO_VBI_PACKET, (dev->cluster_size << 17) | (2 << 11));
 
 	/* Power down audio and chroma DAC+ADC */
 	ctrl_iowrite32(dev, MO_AFECFG_IO, 0x12);
 
-	/* Start DMA */
-	ctrl_iowrite32(dev, MO_DEV_CNTRL2, (1 << 5));
-	ctrl_iowrite32(dev, MO_VID_DMACNTRL, (1 << 7) | (1 << 3));
+	cx88sdr_dma_start(dev);
+}
+
+/* Clusters must fit the SRAM area and split a page evenly */
+static void cx88sdr_cluster_setup(struct cx88sdr_dev *dev)
+{
+	dev->cluster_num = cluster_num;
+	dev->cluster_size = cluster_size;
+
+	if (!is_power_of_2(cluster_size) || cluster_size < CLUSTER_BUF_SIZE_MIN ||
+	    cluster_size > min_t(u32, CLUSTER_BUF_SIZE_MAX, PAGE_SIZE) ||
+	    cluster_num < 2 || cluster_num > CLUSTER_BUF_AREA / cluster_size) {
+		cx88sdr_pr_err("invalid SRAM FIFO %u x %u bytes, using %u x %u\n",
+			       cluster_num, cluster_size, CLUSTER_BUF_NUM, CLUSTER_BUF_SIZE);
+		dev->cluster_num = CLUSTER_BUF_NUM;
+		dev->cluster_size = CLUSTER_BUF_SIZE;
+	}
+
+	cx88sdr_pr_info("SRAM FIFO: %u x %u bytes\n", dev->cluster_num, dev->cluster_size);
 }
 
 static int cx88sdr_alloc_risc_inst_buffer(struct cx88sdr_dev *dev)
 {
-	/* Add 1 page for sync instructions and jump */
-	dev->risc_buf_sz = (VBI_DMA_BUF_NUM * CLUSTER_BUF_NUM + PAGE_SIZE);
+	/* One 8 byte WRITE per cluster, add 1 page for sync instructions and jump */
+	dev->risc_buf_sz = (VBI_DMA_SIZE / dev->cluster_size) * 8 + PAGE_SIZE;
 	dev->risc_buf = dma_alloc_coherent(&dev->pdev->dev,
 					   dev->risc_buf_sz,
 					   &dev->risc_buf_addr, GFP_KERNEL);
@@ -127,8 +186,73 @@ static void cx88sdr_free_risc_inst_buffer(struct cx88sdr_dev *dev)
 				  dev->risc_buf, dev->risc_buf_addr);
 }
 
+/*
+ * Coherent pages can end up uncached (non-x86) or bounced, which makes the
+ * copies in read() slow. Streaming mode maps normal cached pages and read()
+ * syncs only the span it consumes.
+ *
+ * Both come from the card's NUMA node when it has 32-bit memory, coherent
+ * allocations already follow the device's node.
+ */
+static void *cx88sdr_alloc_dma_page(struct cx88sdr_dev *dev, dma_addr_t *dma_handle)
+{
+	struct page *page;
+
+	if (!dev->dma_streaming)
+		return dma_alloc_coherent(&dev->pdev->dev, PAGE_SIZE,
+					  dma_handle, GFP_KERNEL | __GFP_ZERO);
+
+	/*
+	 * The card only reaches 32 bits, keep SWIOTLB out of the data path.
+	 * Zeroed, read() may reach pages the DMA has not written yet.
+	 */
+	page = alloc_pages_node(dev_to_node(&dev->pdev->dev),
+				GFP_KERNEL | __GFP_DMA32 | __GFP_ZERO, 0);
+	if (!page)
+		return NULL;
+
+	*dma_handle = dma_map_page(&dev->pdev->dev, page, 0, PAGE_SIZE,
+				   DMA_FROM_DEVICE);
+	if (dma_mapping_error(&dev->pdev->dev, *dma_handle)) {
+		__free_page(page);
+		return NULL;
+	}
+	return page_address(page);
+}
+
+static void cx88sdr_free_dma_page(struct cx88sdr_dev *dev, void *vaddr,
+				  dma_addr_t dma_handle)
+{
+	if (!dev->dma_streaming) {
+		dma_free_coherent(&dev->pdev->dev, PAGE_SIZE, vaddr, dma_handle);
+		return;
+	}
+
+	dma_unmap_page(&dev->pdev->dev, dma_handle, PAGE_SIZE, DMA_FROM_DEVICE);
+	free_page((unsigned long)vaddr);
+}
+
+/* Coherent memory may be remapped outside the linear map */
+static int cx88sdr_page_nid(const void *vaddr)
+{
+	if (!virt_addr_valid(vaddr))
+		return NUMA_NO_NODE;
+	return page_to_nid(virt_to_page(vaddr));
+}
+
+static u32 cx88sdr_ring_pages_on(struct cx88sdr_dev *dev, int nid)
+{
+	u32 page, cnt = 0;
+
+	for (page = 0; page < VBI_DMA_PAGES; page++)
+		if (cx88sdr_page_nid(dev->dma_buf_pages[page]) == nid)
+			cnt++;
+	return cnt;
+}
+
 static int cx88sdr_alloc_dma_buffer(struct cx88sdr_dev *dev)
 {
+	int node = dev_to_node(&dev->pdev->dev);
 	u32 page, dma_size = 0;
 
 	for (page = 0; page < (VBI_DMA_PAGES + 1); page++) {
@@ -139,16 +263,19 @@ static int cx88sdr_alloc_dma_buffer(struct cx88sdr_dev *dev)
 	for (page = 0; page < VBI_DMA_PAGES; page++) {
 		dma_addr_t dma_handle;
 
-		dev->dma_buf_pages[page] = dma_alloc_coherent(&dev->pdev->dev,
-							      PAGE_SIZE, &dma_handle,
-							      GFP_KERNEL);
+		dev->dma_buf_pages[page] = cx88sdr_alloc_dma_page(dev, &dma_handle);
 		if (!dev->dma_buf_pages[page])
 			return -ENOMEM;
 		dev->dma_pages_addr[page] = dma_handle;
 		dma_size += PAGE_SIZE;
 	}
 
-	cx88sdr_pr_info("DMA Buffer: %u MiB\n", dma_size / SZ_1M);
+	cx88sdr_pr_info("DMA Buffer: %u MiB, %s\n", dma_size / SZ_1M,
+			dev->dma_streaming ? "streaming" : "coherent");
+	/* ZONE_DMA32 often lives on node 0 only, other nodes fall back to it */
+	if (node != NUMA_NO_NODE)
+		cx88sdr_pr_info("DMA Buffer: NUMA node %d, %u of %u pages local\n",
+				node, cx88sdr_ring_pages_on(dev, node), (u32)VBI_DMA_PAGES);
 	return 0;
 }
 
@@ -158,15 +285,14 @@ static void cx88sdr_free_dma_buffer(struct cx88sdr_dev *dev)
 
 	for (page = 0; page < VBI_DMA_PAGES; page++) {
 		if (dev->dma_buf_pages[page])
-			dma_free_coherent(&dev->pdev->dev, PAGE_SIZE,
-					  dev->dma_buf_pages[page],
-					  dev->dma_pages_addr[page]);
+			cx88sdr_free_dma_page(dev, dev->dma_buf_pages[page],
+					      dev->dma_pages_addr[page]);
 	}
 }
 
 static void cx88sdr_make_risc_instructions(struct cx88sdr_dev *dev)
 {
-	uint32_t dma_addr, loop_addr, page, irq_cnt = 0;
+	uint32_t dma_addr, loop_addr, page, offset, irq_cnt = 0;
 	uint32_t *risc_buf = dev->risc_buf;
 
 	loop_addr = dev->risc_buf_addr + 4;
@@ -174,14 +300,19 @@ static void cx88sdr_make_risc_instructions(struct cx88sdr_dev *dev)
 
 	for (page = 0; page < VBI_DMA_PAGES; page++) {
 		irq_cnt++;
-		irq_cnt &= 0x1ff;
-		*risc_buf++ = RISC_WRITE | CLUSTER_BUF_SIZE | (3 << 26);
+		irq_cnt &= (CX88SDR_IRQ_PAGES - 1);
 		dma_addr = dev->dma_pages_addr[page];
-		*risc_buf++ = dma_addr;
-		*risc_buf++ = RISC_WRITE | CLUSTER_BUF_SIZE | (3 << 26) |
-			      (((irq_cnt == 0) ? 1 : 0) << 24) |
-			      (((page < VBI_DMA_PAGES - 1) ? 1 : 3) << 16);
-		*risc_buf++ = dma_addr + CLUSTER_BUF_SIZE;
+
+		/* The last cluster of a page counts it and may raise the IRQ */
+		for (offset = 0; offset < PAGE_SIZE; offset += dev->cluster_size) {
+			uint32_t cmd = RISC_WRITE | dev->cluster_size | (3 << 26);
+
+			if (offset + dev->cluster_size == PAGE_SIZE)
+				cmd |= (((irq_cnt == 0) ? 1 : 0) << 24) |
+				       (((page < VBI_DMA_PAGES - 1) ? 1 : 3) << 16);
+			*risc_buf++ = cmd;
+			*risc_buf++ = dma_addr + offset;
+		}
 	}
 	*risc_buf++ = RISC_JUMP;
 	*risc_buf++ = loop_addr;
@@ -190,6 +321,123 @@ static void cx88sdr_make_risc_instructions(struct cx88sdr_dev *dev)
 		       (uint32_t)(((void *)risc_buf - (void *)dev->risc_buf) / SZ_1K));
 }
 
+/*
+ * Absolute number of the page the RISC engine is writing, everything before
+ * it is complete. MO_VBI_GPCNT restarts on every lap, a lap is counted when
+ * it goes backwards. The RISC IRQ samples it often enough to never miss one.
+ */
+u64 cx88sdr_ring_head(struct cx88sdr_dev *dev)
+{
+	unsigned long flags;
+	u32 gpcnt;
+	u64 head;
+
+	spin_lock_irqsave(&dev->ring_lock, flags);
+	gpcnt = ctrl_ioread32(dev, MO_VBI_GPCNT);
+	if (gpcnt < dev->ring_gpcnt)
+		dev->ring_lap++;
+	dev->ring_gpcnt = gpcnt;
+	head = dev->ring_lap * VBI_DMA_PAGES + gpcnt - 1;
+	atomic64_set(&dev->ring_seen, head);
+	spin_unlock_irqrestore(&dev->ring_lock, flags);
+
+	return head;
+}
+
+/*
+ * Restart the RISC program from its first instruction without touching the
+ * ring or the open handles. The restart begins a new lap, the rest of the
+ * current one is never written and is reported as a hole.
+ */
+static void cx88sdr_dma_restart(struct cx88sdr_dev *dev, u32 status)
+{
+	unsigned long flags, ring_flags;
+	u64 first, clean;
+
+	spin_lock_irqsave(&dev->seg_lock, flags);
+	first = cx88sdr_ring_head(dev);
+
+	ctrl_iowrite32(dev, MO_VID_DMACNTRL, 0);
+	ctrl_iowrite32(dev, MO_DEV_CNTRL2, 0);
+	ctrl_iowrite32(dev, MO_VBI_GPCNTRL, GP_COUNT_CONTROL_RESET);
+	cx88sdr_sram_setup(dev, dev->cluster_num, dev->cluster_size,
+			   CLUSTER_BUF_BASE, CDT_BASE);
+	ctrl_iowrite32(dev, MO_VID_INTSTAT, ~0u);
+
+	spin_lock_irqsave(&dev->ring_lock, ring_flags);
+	dev->ring_lap++;
+	dev->ring_gpcnt = 0;
+	clean = dev->ring_lap * VBI_DMA_PAGES;
+	spin_unlock_irqrestore(&dev->ring_lock, ring_flags);
+
+	cx88sdr_dma_start(dev);
+
+	atomic64_inc(&dev->recoveries);
+	cx88sdr_queue_recovery(dev, first << PAGE_SHIFT, clean << PAGE_SHIFT, status);
+	spin_unlock_irqrestore(&dev->seg_lock, flags);
+
+	cx88sdr_pr_err_ratelimited("DMA restarted, status 0x%05x\n", status);
+}
+
+/*
+ * Restarts the DMA after a fatal error from the IRQ or when the ring stops.
+ * While restarts don't get the ring moving the checks back off, after
+ * CX88SDR_RESTARTS in a row the DMA is left stopped until the module is
+ * reloaded.
+ */
+static void cx88sdr_watchdog(struct work_struct *work)
+{
+	struct cx88sdr_dev *dev = container_of(to_delayed_work(work),
+					       struct cx88sdr_dev, watchdog);
+	u32 status;
+	u64 head;
+
+	if (!READ_ONCE(dev->running))
+		return;
+
+	status = atomic_xchg(&dev->recover_status, 0);
+	head = cx88sdr_ring_head(dev);
+	if (!status && head != dev->watchdog_head) {
+		dev->watchdog_fails = 0;
+	} else if (dev->watchdog_fails < CX88SDR_RESTARTS) {
+		dev->watchdog_fails++;
+		cx88sdr_dma_restart(dev, status);
+		head = cx88sdr_ring_head(dev);
+	} else {
+		/* Error interrupts may still call, report once */
+		if (dev->watchdog_fails++ == CX88SDR_RESTARTS) {
+			cx88sdr_pr_err("DMA still stopped after %u restarts, giving up\n",
+				       CX88SDR_RESTARTS);
+			cx88sdr_queue_stopped(dev, status);
+		}
+		return;
+	}
+	dev->watchdog_head = head;
+
+	schedule_delayed_work(&dev->watchdog, CX88SDR_WATCHDOG << dev->watchdog_fails);
+}
+
+static void cx88sdr_irq_errors(struct cx88sdr_dev *dev, u32 status)
+{
+	if (status & INTERRUPT_VBI_OFLOW)
+		atomic64_inc(&dev->overflows);
+
+	if (!(status & INTERRUPT_ERRORS))
+		return;
+
+	atomic64_inc(&dev->errors);
+	cx88sdr_pr_warn_ratelimited("%s%s%s%s\n",
+				    (status & INTERRUPT_OPC_ERR) ? " opc_err" : "",
+				    (status & INTERRUPT_PAR_ERR) ? " par_err" : "",
+				    (status & INTERRUPT_RIP_ERR) ? " rip_err" : "",
+				    (status & INTERRUPT_PCI_ABORT) ? " pci_abort" : "");
+
+	if (status & INTERRUPT_FATAL) {
+		atomic_or(status & INTERRUPT_FATAL, &dev->recover_status);
+		mod_delayed_work(system_wq, &dev->watchdog, 0);
+	}
+}
+
 static irqreturn_t cx88sdr_irq(int __always_unused irq, void *dev_id)
 {
 	struct cx88sdr_dev *dev = dev_id;
@@ -203,26 +451,150 @@ static irqreturn_t cx88sdr_irq(int __always_unused irq, void *dev_id)
 			goto out;
 		ctrl_iowrite32(dev, MO_VID_INTSTAT, status);
 		handled = 1;
+
+		cx88sdr_irq_errors(dev, status & mask);
+
+		/* Another batch of pages is complete */
+		if (status & INTERRUPT_VBI_RISCI1) {
+			cx88sdr_scan_step(dev, cx88sdr_ring_head(dev));
+			if (atomic_read(&dev->stats_users))
+				schedule_work(&dev->stats_work);
+			wake_up_interruptible(&dev->read_wq);
+		}
 	}
 
 out:
 	return IRQ_RETVAL(handled);
 }
 
+/*
+ * Readers are woken from the RISC IRQ, so its CPU is also where they tend to
+ * run. Keep it on the card's node unless a CPU was chosen.
+ */
+static void cx88sdr_irq_affinity(struct cx88sdr_dev *dev)
+{
+	int node = dev_to_node(&dev->pdev->dev);
+	int cpu = irq_cpu[dev->nr];
+
+	if (cpu >= 0 && cpu < nr_cpu_ids && cpu_online(cpu))
+		dev->irq_hint = cpumask_of(cpu);
+	else if (cpu >= 0)
+		cx88sdr_pr_err("irq_cpu %d is not online, ignored\n", cpu);
+	else if (node != NUMA_NO_NODE &&
+		 cpumask_intersects(cpumask_of_node(node), cpu_online_mask))
+		dev->irq_hint = cpumask_of_node(node);
+
+	if (!dev->irq_hint)
+		return;
+	irq_set_affinity_hint(dev->irq, dev->irq_hint);
+	cx88sdr_pr_info("IRQ affinity hint: CPUs %*pbl\n", cpumask_pr_args(dev->irq_hint));
+}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 10, 0)
+#define sysfs_emit(buf, fmt, ...) \
+	scnprintf(buf, PAGE_SIZE, fmt, ##__VA_ARGS__)
+#define sysfs_emit_at(buf, at, fmt, ...) \
+	scnprintf((buf) + (at), PAGE_SIZE - (at), fmt, ##__VA_ARGS__)
+#endif
+
+static struct cx88sdr_dev *cx88sdr_from_device(struct device *d)
+{
+	struct v4l2_device *v4l2_dev = dev_get_drvdata(d);
+
+	return container_of(v4l2_dev, struct cx88sdr_dev, v4l2_dev);
+}
+
+/* Ring pages per node, like numa_maps */
+static ssize_t ring_nodes_show(struct device *d, struct device_attribute *attr,
+			       char *buf)
+{
+	struct cx88sdr_dev *dev = cx88sdr_from_device(d);
+	u32 cnt, other = VBI_DMA_PAGES;
+	int nid, len = 0;
+
+	for_each_node_state(nid, N_MEMORY) {
+		cnt = cx88sdr_ring_pages_on(dev, nid);
+		if (cnt)
+			len += sysfs_emit_at(buf, len, "%sN%d=%u", len ? " " : "", nid, cnt);
+		other -= cnt;
+	}
+	if (other)
+		len += sysfs_emit_at(buf, len, "%sunknown=%u", len ? " " : "", other);
+	len += sysfs_emit_at(buf, len, "\n");
+	return len;
+}
+static DEVICE_ATTR_RO(ring_nodes);
+
+static ssize_t irq_show(struct device *d, struct device_attribute *attr,
+			char *buf)
+{
+	return sysfs_emit(buf, "%u\n", cx88sdr_from_device(d)->irq);
+}
+static DEVICE_ATTR_RO(irq);
+
+/* Where the IRQ actually lands, the hint only asks for it */
+static ssize_t irq_cpus_show(struct device *d, struct device_attribute *attr,
+			     char *buf)
+{
+	struct irq_data *data = irq_get_irq_data(cx88sdr_from_device(d)->irq);
+	const struct cpumask *mask;
+
+	if (!data)
+		return -ENODEV;
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 13, 0)
+	mask = irq_data_get_affinity_mask(data);
+#else
+	mask = irq_data_get_effective_affinity_mask(data);
+#endif
+	return sysfs_emit(buf, "%*pbl\n", cpumask_pr_args(mask));
+}
+static DEVICE_ATTR_RO(irq_cpus);
+
+static ssize_t irq_hint_show(struct device *d, struct device_attribute *attr,
+			     char *buf)
+{
+	struct cx88sdr_dev *dev = cx88sdr_from_device(d);
+
+	if (!dev->irq_hint)
+		return sysfs_emit(buf, "\n");
+	return sysfs_emit(buf, "%*pbl\n", cpumask_pr_args(dev->irq_hint));
+}
+static DEVICE_ATTR_RO(irq_hint);
+
+static struct attribute *cx88sdr_attrs[] = {
+	&dev_attr_ring_nodes.attr,
+	&dev_attr_irq.attr,
+	&dev_attr_irq_cpus.attr,
+	&dev_attr_irq_hint.attr,
+	NULL,
+};
+
+/* Under the PCI device, /sys/class/video4linux/swradioN/device/cx88sdr */
+static const struct attribute_group cx88sdr_attr_group = {
+	.name	= "cx88sdr",
+	.attrs	= cx88sdr_attrs,
+};
+
+static const struct attribute_group *cx88sdr_attr_groups[] = {
+	&cx88sdr_attr_group,
+	NULL,
+};
+
 static int cx88sdr_probe(struct pci_dev *pdev,
 			 const struct pci_device_id __always_unused *pci_id)
 {
 	struct cx88sdr_dev *dev;
 	struct v4l2_device *v4l2_dev;
 	struct v4l2_ctrl_handler *hdl;
-	int ret;
+	int nr, ret;
 
-	if (cx88sdr_devcount >= CX88SDR_MAX_CARDS)
-		return -ENODEV;
+	nr = cx88sdr_slot_get();
+	if (nr < 0)
+		return nr;
 
 	ret = pci_enable_device(pdev);
 	if (ret)
-		return ret;
+		goto put_slot;
 
 	pci_set_master(pdev);
 
@@ -239,8 +611,21 @@ static int cx88sdr_probe(struct pci_dev *pdev,
 		goto disable_device;
 	}
 
-	dev->nr = cx88sdr_devcount;
+	dev->nr = nr;
 	dev->pdev = pdev;
+	dev->dma_streaming = dma_streaming;
+	dev->zero_read = zero_read;
+	cx88sdr_cluster_setup(dev);
+	init_waitqueue_head(&dev->read_wq);
+	INIT_LIST_HEAD(&dev->fh_list);
+	spin_lock_init(&dev->fh_lock);
+	spin_lock_init(&dev->seg_lock);
+	INIT_WORK(&dev->stats_work, cx88sdr_stats_work);
+	INIT_DELAYED_WORK(&dev->watchdog, cx88sdr_watchdog);
+	spin_lock_init(&dev->ring_lock);
+	/* Start on lap 1 so the head never wraps below zero */
+	dev->ring_lap = 1;
+	dev->ring_first = dev->ring_lap * VBI_DMA_PAGES;
 
 	cx88sdr_pci_lat_set(dev);
 
@@ -273,7 +658,7 @@ static int cx88sdr_probe(struct pci_dev *pdev,
 
 	cx88sdr_shutdown(dev);
 
-	cx88sdr_sram_setup(dev, CLUSTER_BUF_NUM, CLUSTER_BUF_SIZE,
+	cx88sdr_sram_setup(dev, dev->cluster_num, dev->cluster_size,
 			   CLUSTER_BUF_BASE, CDT_BASE);
 
 	ret = request_irq(pdev->irq, cx88sdr_irq, IRQF_SHARED, KBUILD_MODNAME, dev);
@@ -284,10 +669,13 @@ static int cx88sdr_probe(struct pci_dev *pdev,
 
 	dev->irq = pdev->irq;
 	synchronize_irq(dev->irq);
+	cx88sdr_irq_affinity(dev);
 
 	/* Set initial values */
 	dev->gain = 0;
 	dev->input = CX88SDR_INPUT_00;
+	dev->input_sel = dev->input;
+	dev->scan_dwell = 16 * CX88SDR_IRQ_PAGES;
 	dev->sdr_band = CX88SDR_BAND_01;
 	dev->pixelformat = V4L2_SDR_FMT_RU8;
 	dev->buffersize = PAGE_SIZE;
@@ -302,6 +690,9 @@ static int cx88sdr_probe(struct pci_dev *pdev,
 
 	cx88sdr_agc_setup(dev);
 	cx88sdr_input_set(dev);
+	/* Everything so far belongs to the initial input */
+	dev->seg[0].input = dev->input;
+	dev->seg_cnt = 1;
 
 	mutex_init(&dev->vdev_mlock);
 	v4l2_dev = &dev->v4l2_dev;
@@ -312,9 +703,16 @@ static int cx88sdr_probe(struct pci_dev *pdev,
 	}
 
 	hdl = &dev->ctrl_handler;
-	v4l2_ctrl_handler_init(hdl, 2);
+	v4l2_ctrl_handler_init(hdl, 9);
 	v4l2_ctrl_new_std(hdl, &cx88sdr_ctrl_ops, V4L2_CID_GAIN, 0, 31, 1, dev->gain);
 	v4l2_ctrl_new_custom(hdl, &cx88sdr_ctrl_input, NULL);
+	v4l2_ctrl_new_custom(hdl, &cx88sdr_ctrl_start, NULL);
+	v4l2_ctrl_new_custom(hdl, &cx88sdr_ctrl_scan_inputs, NULL);
+	v4l2_ctrl_new_custom(hdl, &cx88sdr_ctrl_scan_dwell, NULL);
+	v4l2_ctrl_new_custom(hdl, &cx88sdr_ctrl_overflows, NULL);
+	v4l2_ctrl_new_custom(hdl, &cx88sdr_ctrl_overruns, NULL);
+	v4l2_ctrl_new_custom(hdl, &cx88sdr_ctrl_errors, NULL);
+	v4l2_ctrl_new_custom(hdl, &cx88sdr_ctrl_recoveries, NULL);
 	v4l2_dev->ctrl_handler = hdl;
 	if (hdl->error) {
 		ret = hdl->error;
@@ -330,24 +728,40 @@ static int cx88sdr_probe(struct pci_dev *pdev,
 	dev->vdev.v4l2_dev = v4l2_dev;
 	video_set_drvdata(&dev->vdev, dev);
 
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 3, 0)
+	/* No dev_groups in the driver core yet */
+	ret = sysfs_create_groups(&pdev->dev.kobj, cx88sdr_attr_groups);
+	if (ret) {
+		cx88sdr_pr_err("can't create sysfs attributes\n");
+		goto free_v4l2;
+	}
+#endif
+
 	ret = video_register_device(&dev->vdev, VFL_TYPE_SDR, -1);
 	if (ret)
-		goto free_v4l2;
+		goto remove_groups;
 
 	cx88sdr_pr_info("irq: %u, Ctrl MMIO: 0x%p, PCI latency: %d\n",
 			dev->pdev->irq, dev->ctrl, dev->pci_lat);
-	cx88sdr_pr_info("registered as %s\n",
+	cx88sdr_pr_info("card %d registered as %s\n", dev->nr,
 			video_device_node_name(&dev->vdev));
 
 	ctrl_iowrite32(dev, MO_VID_INTMSK, INTERRUPT_MASK);
-	cx88sdr_devcount++;
+	dev->running = true;
+	schedule_delayed_work(&dev->watchdog, CX88SDR_WATCHDOG);
 	return 0;
 
+remove_groups:
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 3, 0)
+	sysfs_remove_groups(&pdev->dev.kobj, cx88sdr_attr_groups);
+#endif
 free_v4l2:
 	v4l2_ctrl_handler_free(hdl);
 	v4l2_device_unregister(v4l2_dev);
 free_irq:
+	irq_set_affinity_hint(dev->irq, NULL);
 	free_irq(dev->irq, dev);
+	cancel_work_sync(&dev->stats_work);
 free_ctrl:
 	iounmap(dev->ctrl);
 free_dma_buffer:
@@ -358,6 +772,8 @@ free_pci_regions:
 	pci_release_regions(pdev);
 disable_device:
 	pci_disable_device(pdev);
+put_slot:
+	clear_bit(nr, cx88sdr_slots);
 	return ret;
 }
 
@@ -366,23 +782,30 @@ static void cx88sdr_remove(struct pci_dev *pdev)
 	struct v4l2_device *v4l2_dev = pci_get_drvdata(pdev);
 	struct cx88sdr_dev *dev = container_of(v4l2_dev, struct cx88sdr_dev, v4l2_dev);
 
+	WRITE_ONCE(dev->running, false);
+	cancel_delayed_work_sync(&dev->watchdog);
 	cx88sdr_shutdown(dev);
 
 	cx88sdr_pr_info("removing %s\n", video_device_node_name(&dev->vdev));
 
-	cx88sdr_devcount--;
-
 	video_unregister_device(&dev->vdev);
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 3, 0)
+	sysfs_remove_groups(&pdev->dev.kobj, cx88sdr_attr_groups);
+#endif
 	v4l2_ctrl_handler_free(&dev->ctrl_handler);
 	v4l2_device_unregister(&dev->v4l2_dev);
 
 	/* Release resources */
+	irq_set_affinity_hint(dev->irq, NULL);
 	free_irq(dev->irq, dev);
+	cancel_work_sync(&dev->stats_work);
+	cancel_delayed_work_sync(&dev->watchdog);
 	iounmap(dev->ctrl);
 	cx88sdr_free_dma_buffer(dev);
 	cx88sdr_free_risc_inst_buffer(dev);
 	pci_release_regions(pdev);
 	pci_disable_device(pdev);
+	clear_bit(dev->nr, cx88sdr_slots);
 }
 
 static const struct pci_device_id cx88sdr_pci_tbl[] = {
@@ -396,6 +819,12 @@ static struct pci_driver cx88sdr_pci_driver = {
 	.id_table	= cx88sdr_pci_tbl,
 	.probe		= cx88sdr_probe,
 	.remove		= cx88sdr_remove,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 3, 0)
+	/* Created by the driver core once probe succeeds, removed before remove */
+	.driver		= {
+		.dev_groups	= cx88sdr_attr_groups,
+	},
+#endif
 };
 
 module_pci_driver(cx88sdr_pci_driver);
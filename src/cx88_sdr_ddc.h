@@ -0,0 +1,184 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (c) 2020 Jorge Maidana <jorgem.seq@gmail.com>
+ *
+ * Integer real to complex conversion: fs/4 mixer followed by a half-band
+ * FIR and decimation by 2. The output covers 0 to fs/2 of the real input,
+ * centered at fs/4, at fs/2 complex samples per second.
+ *
+ * With the mixer sequence 1, -j, -1, j the even input samples only reach
+ * the I branch and the odd ones only the Q branch. The half-band center tap
+ * lands on the odd samples, so Q is a plain delayed copy and I is a short
+ * symmetric FIR over the even samples, L multiplies per output sample.
+ *
+ * Everything is fixed point, so results are bit-exact on any host. The
+ * driver builds its CS8/CS16LE formats from this file and the tools use it
+ * as the reference.
+ */
+
+#ifndef CX88SDR_DDC_H
+#define CX88SDR_DDC_H
+
+#ifdef __KERNEL__
+#include <linux/string.h>
+#include <linux/types.h>
+#include <asm/byteorder.h>
+#else
+#include <stdint.h>
+#include <string.h>
+#endif
+
+#define DDC_HB_TAPS		8	/* Nonzero taps on each side of the center */
+#define DDC_BLOCK		256	/* Complex outputs per pass */
+#define DDC_E_HIST		(2 * DDC_HB_TAPS - 1)
+#define DDC_O_HIST		(DDC_HB_TAPS)
+
+/* Q15, one side of a 31 tap Kaiser half-band, summing to 0.25 */
+/* RU16LE input and CS16LE output are little-endian whatever the host */
+#ifdef __KERNEL__
+typedef __le16 ddc_le16;
+
+static inline uint16_t ddc_get_le16(const ddc_le16 *p)
+{
+	return le16_to_cpu(*p);
+}
+
+static inline void ddc_put_le16(ddc_le16 *p, uint16_t v)
+{
+	*p = cpu_to_le16(v);
+}
+#else
+typedef uint16_t ddc_le16;
+
+static inline uint16_t ddc_get_le16(const ddc_le16 *p)
+{
+	const uint8_t *b = (const uint8_t *)p;
+
+	return b[0] | b[1] << 8;
+}
+
+static inline void ddc_put_le16(ddc_le16 *p, uint16_t v)
+{
+	uint8_t *b = (uint8_t *)p;
+
+	b[0] = v;
+	b[1] = v >> 8;
+}
+#endif
+
+static const int16_t ddc_hb_coefs[DDC_HB_TAPS] = {
+	10323, -3157, 1588, -861, 454, -218, 88, -25,
+};
+
+struct ddc {
+	int32_t		e[DDC_E_HIST + DDC_BLOCK];	/* Mixed even samples */
+	int32_t		o[DDC_O_HIST + DDC_BLOCK];	/* Mixed odd samples */
+	int32_t		i[DDC_BLOCK];
+	int32_t		q[DDC_BLOCK];
+	uint32_t	phase;				/* Input pairs seen */
+};
+
+static inline void ddc_reset(struct ddc *d)
+{
+	memset(d, 0, sizeof(*d));
+}
+
+/* Mixer sign of input pair r is (-1)^r, for the even and the odd sample */
+static inline void ddc_load_u8(struct ddc *d, const uint8_t *in, unsigned int n)
+{
+	int32_t *e = d->e + DDC_E_HIST, *o = d->o + DDC_O_HIST;
+	unsigned int k;
+
+	for (k = 0; k < n; k++) {
+		int32_t s = 1 - (int32_t)(((d->phase + k) & 1) << 1);
+
+		e[k] = s * ((int32_t)in[2 * k] - 128);
+		o[k] = s * ((int32_t)in[2 * k + 1] - 128);
+	}
+	d->phase += n;
+}
+
+static inline void ddc_load_u16(struct ddc *d, const ddc_le16 *in, unsigned int n)
+{
+	int32_t *e = d->e + DDC_E_HIST, *o = d->o + DDC_O_HIST;
+	unsigned int k;
+
+	for (k = 0; k < n; k++) {
+		int32_t s = 1 - (int32_t)(((d->phase + k) & 1) << 1);
+
+		e[k] = s * ((int32_t)ddc_get_le16(&in[2 * k]) - 32768);
+		o[k] = s * ((int32_t)ddc_get_le16(&in[2 * k + 1]) - 32768);
+	}
+	d->phase += n;
+}
+
+/*
+ * Filter the n pairs loaded last into d->i and d->q. The complex output is
+ * scaled by 2, a real tone keeps its amplitude.
+ */
+static inline void ddc_filter(struct ddc *d, unsigned int n)
+{
+	const int32_t *e = d->e;
+	unsigned int k, j;
+
+	for (k = 0; k < n; k++) {
+		int32_t acc = 0;
+
+		for (j = 0; j < DDC_HB_TAPS; j++)
+			acc += ddc_hb_coefs[j] *
+			       (e[k + DDC_HB_TAPS + j] + e[k + DDC_HB_TAPS - 1 - j]);
+		d->i[k] = (acc + (1 << 13)) >> 14;
+		d->q[k] = -d->o[k];
+	}
+
+	memmove(d->e, d->e + n, DDC_E_HIST * sizeof(d->e[0]));
+	memmove(d->o, d->o + n, DDC_O_HIST * sizeof(d->o[0]));
+}
+
+static inline int32_t ddc_clamp(int32_t v, int32_t lo, int32_t hi)
+{
+	return v < lo ? lo : (v > hi ? hi : v);
+}
+
+static inline void ddc_store_cs8(const struct ddc *d, int8_t *out, unsigned int n)
+{
+	unsigned int k;
+
+	for (k = 0; k < n; k++) {
+		out[2 * k]     = ddc_clamp(d->i[k], -128, 127);
+		out[2 * k + 1] = ddc_clamp(d->q[k], -128, 127);
+	}
+}
+
+static inline void ddc_store_cu8(const struct ddc *d, uint8_t *out, unsigned int n)
+{
+	unsigned int k;
+
+	for (k = 0; k < n; k++) {
+		out[2 * k]     = ddc_clamp(d->i[k] + 128, 0, 255);
+		out[2 * k + 1] = ddc_clamp(d->q[k] + 128, 0, 255);
+	}
+}
+
+static inline void ddc_store_cs16(const struct ddc *d, ddc_le16 *out, unsigned int n)
+{
+	unsigned int k;
+
+	for (k = 0; k < n; k++) {
+		ddc_put_le16(&out[2 * k],     ddc_clamp(d->i[k], -32768, 32767));
+		ddc_put_le16(&out[2 * k + 1], ddc_clamp(d->q[k], -32768, 32767));
+	}
+}
+
+/* 16-bit input to 8-bit unsigned IQ, for clients that only take CU8 */
+static inline void ddc_store_cu8_from16(const struct ddc *d, uint8_t *out, unsigned int n)
+{
+	unsigned int k;
+
+	for (k = 0; k < n; k++) {
+		out[2 * k]     = ddc_clamp((d->i[k] >> 8) + 128, 0, 255);
+		out[2 * k + 1] = ddc_clamp((d->q[k] >> 8) + 128, 0, 255);
+	}
+}
+
+#endif
@@ -0,0 +1,112 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later WITH Linux-syscall-note */
+/*
+ * Copyright (c) 2020 Jorge Maidana <jorgem.seq@gmail.com>
+ *
+ * Definitions shared between the cx88_sdr driver and user space.
+ */
+
+#ifndef CX88SDR_UAPI_H
+#define CX88SDR_UAPI_H
+
+#include <linux/types.h>
+#include <linux/videodev2.h>
+
+/* Real formats */
+#ifndef V4L2_SDR_FMT_RU8
+#define V4L2_SDR_FMT_RU8		V4L2_SDR_FMT_CU8
+#endif
+#ifndef V4L2_SDR_FMT_RU16LE
+#define V4L2_SDR_FMT_RU16LE		V4L2_SDR_FMT_CU16LE
+#endif
+
+/* Complex formats, fs/4 DDC output at half the real rate */
+#ifndef V4L2_SDR_FMT_CS8
+#define V4L2_SDR_FMT_CS8		v4l2_fourcc('C', 'S', '0', '8')
+#endif
+#ifndef V4L2_SDR_FMT_CS16LE
+#define V4L2_SDR_FMT_CS16LE		v4l2_fourcc('C', 'S', '1', '6')
+#endif
+
+/* The base for the cx88_sdr driver controls. Total of 16 controls are reserved
+ * for this driver */
+#ifndef V4L2_CID_USER_CX88SDR_BASE
+#define V4L2_CID_USER_CX88SDR_BASE	(V4L2_CID_USER_BASE + 0x1f10)
+#endif
+
+enum {
+	V4L2_CID_CX88SDR_INPUT		= (V4L2_CID_USER_CX88SDR_BASE + 0),
+	V4L2_CID_CX88SDR_START		= (V4L2_CID_USER_CX88SDR_BASE + 1),
+	V4L2_CID_CX88SDR_MAX_LATENCY	= (V4L2_CID_USER_CX88SDR_BASE + 2),
+	V4L2_CID_CX88SDR_SKIPPED	= (V4L2_CID_USER_CX88SDR_BASE + 3),
+	V4L2_CID_CX88SDR_SCAN_INPUTS	= (V4L2_CID_USER_CX88SDR_BASE + 4),
+	V4L2_CID_CX88SDR_SCAN_DWELL	= (V4L2_CID_USER_CX88SDR_BASE + 5),
+	V4L2_CID_CX88SDR_INPUT_FILTER	= (V4L2_CID_USER_CX88SDR_BASE + 6),
+	V4L2_CID_CX88SDR_OVERFLOWS	= (V4L2_CID_USER_CX88SDR_BASE + 7),
+	V4L2_CID_CX88SDR_ERRORS		= (V4L2_CID_USER_CX88SDR_BASE + 8),
+	V4L2_CID_CX88SDR_RECOVERIES	= (V4L2_CID_USER_CX88SDR_BASE + 9),
+	V4L2_CID_CX88SDR_OVERRUNS	= (V4L2_CID_USER_CX88SDR_BASE + 10),
+};
+
+/* Events */
+#define V4L2_EVENT_CX88SDR_DISCONTINUITY	(V4L2_EVENT_PRIVATE_START + 0)
+#define V4L2_EVENT_CX88SDR_RECONFIG		(V4L2_EVENT_PRIVATE_START + 1)
+#define V4L2_EVENT_CX88SDR_STATS		(V4L2_EVENT_PRIVATE_START + 2)
+#define V4L2_EVENT_CX88SDR_RECOVERY		(V4L2_EVENT_PRIVATE_START + 3)
+
+/*
+ * Offsets count bytes since the handle was opened, as returned by read(),
+ * including any bytes that were skipped.
+ */
+struct v4l2_event_cx88sdr_discontinuity {
+	__u64	offset;		/* Where the data resumes */
+	__u64	skipped;	/* Bytes left out right before offset */
+};
+
+/*
+ * A rate, format or input change. The bytes in [offset - mixed, offset) hold
+ * an unknown mix of the old and the new configuration, everything from offset
+ * on is captured with the new one.
+ */
+struct v4l2_event_cx88sdr_reconfig {
+	__u64	offset;
+	__u64	mixed;
+	__u32	pixelformat;
+	__u32	rate;		/* Samples per second */
+	__u32	input;
+	__u32	reserved;
+};
+
+/*
+ * Level statistics over a few pages of every RISC IRQ block, sent while
+ * subscribed. Sample values are raw ADC codes, mean and rms are in 1/256
+ * of a code, mean relative to mid scale (the DC offset).
+ */
+struct v4l2_event_cx88sdr_stats {
+	__u64	offset;		/* First byte analyzed */
+	__u32	samples;
+	__u32	clipped;	/* Samples at either end of the range */
+	__u32	min;
+	__u32	max;
+	__s32	mean;
+	__u32	rms;		/* AC only, DC removed */
+	__u32	input;
+	__u32	reserved;
+};
+
+/*
+ * The DMA was restarted after a stall or a RISC/PCI error. The bytes in
+ * [offset - lost, offset) were never written and are skipped by read().
+ * With V4L2_CX88SDR_RECOVERY_STOPPED restarts kept failing and the driver
+ * gave up, no data follows offset.
+ */
+#define V4L2_CX88SDR_RECOVERY_STOPPED		0x1
+
+struct v4l2_event_cx88sdr_recovery {
+	__u64	offset;
+	__u64	lost;
+	__u32	status;		/* MO_VID_INTSTAT error bits, 0 for a stall */
+	__u32	count;		/* Recoveries since the driver was loaded */
+	__u32	flags;
+};
+
+#endif
@@ -17,31 +17,51 @@
  * Copyright (c) 2013-2015 Chad Page <Chad.Page@gmail.com>
  */
 
+#include <linux/kernel.h>
+#include <linux/math64.h>
 #include <linux/pci.h>
+#include <linux/version.h>
 #include <linux/videodev2.h>
 #include <media/v4l2-dev.h>
 #include <media/v4l2-event.h>
 #include <media/v4l2-ioctl.h>
 
 #include "cx88_sdr.h"
+#include "cx88_sdr_ddc.h"
 
 #define CX88SDR_V4L2_NAME		"CX2388x SDR V4L2"
 
-/* The base for the cx88_sdr driver controls. Total of 16 controls are reserved
- * for this driver */
-#ifndef V4L2_CID_USER_CX88SDR_BASE
-#define V4L2_CID_USER_CX88SDR_BASE	(V4L2_CID_USER_BASE + 0x1f10)
-#endif
-
-enum {
-	V4L2_CID_CX88SDR_INPUT	= (V4L2_CID_USER_CX88SDR_BASE + 0),
-};
+/* I/Q pairs fed to the DDC before its first output */
+#define CX88SDR_DDC_PRIME		(DDC_E_HIST + 1)
 
 struct cx88sdr_fh {
 	struct v4l2_fh fh;
 	struct cx88sdr_dev *dev;
+	struct list_head list;
+
+	/* Per-handle controls */
+	struct v4l2_ctrl_handler ctrl_handler;
+	u32 max_latency;
+	u32 input_filter;
+
+	/* Ring byte sequence at stream offset 0 */
+	u64 start;
+	u64 skipped;
+
+	/* CS8/CS16LE output, the DDC state continues at ddc_seq */
+	bool complex;
+	bool ddc_wide;
+	struct mutex ddc_lock;
+	u64 ddc_seq;
+	struct ddc ddc;
+	u8 ddc_out[DDC_BLOCK * 4];
 };
 
+static inline struct cx88sdr_fh *cx88sdr_file_fh(struct file *file)
+{
+	return container_of(file->private_data, struct cx88sdr_fh, fh);
+}
+
 static const struct v4l2_frequency_band cx88sdr_bands_ru08[] = {
 	[CX88SDR_BAND_00] = {
 		.tuner		= 0,
@@ -96,24 +116,65 @@ static const struct v4l2_frequency_band cx88sdr_bands_ru16[] = {
 	},
 };
 
+static const struct v4l2_ctrl_config cx88sdr_ctrl_max_latency;
+static const struct v4l2_ctrl_config cx88sdr_ctrl_skipped;
+static const struct v4l2_ctrl_config cx88sdr_ctrl_input_filter;
+
 static int cx88sdr_open(struct file *file)
 {
 	struct video_device *vdev = video_devdata(file);
 	struct cx88sdr_dev *dev = container_of(vdev, struct cx88sdr_dev, vdev);
+	struct v4l2_ctrl_handler *hdl;
 	struct cx88sdr_fh *fh;
+	unsigned long flags;
+	u64 head;
+	int ret;
 
 	fh = kzalloc(sizeof(*fh), GFP_KERNEL);
 	if (!fh)
 		return -ENOMEM;
 
 	v4l2_fh_init(&fh->fh, vdev);
-
 	fh->dev = dev;
+	mutex_init(&fh->ddc_lock);
+
+	/* Handle controls first, then the device ones */
+	hdl = &fh->ctrl_handler;
+	v4l2_ctrl_handler_init(hdl, 3);
+	v4l2_ctrl_new_custom(hdl, &cx88sdr_ctrl_max_latency, NULL);
+	v4l2_ctrl_new_custom(hdl, &cx88sdr_ctrl_skipped, NULL);
+	v4l2_ctrl_new_custom(hdl, &cx88sdr_ctrl_input_filter, NULL);
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 20, 0)
+	v4l2_ctrl_add_handler(hdl, &dev->ctrl_handler, NULL);
+#else
+	v4l2_ctrl_add_handler(hdl, &dev->ctrl_handler, NULL, false);
+#endif
+	if (hdl->error) {
+		ret = hdl->error;
+		v4l2_ctrl_handler_free(hdl);
+		v4l2_fh_exit(&fh->fh);
+		kfree(fh);
+		return ret;
+	}
+	fh->fh.ctrl_handler = hdl;
+
 	file->private_data = &fh->fh;
 	v4l2_fh_add(&fh->fh);
 
-	dev->start_page = ctrl_ioread32(dev, MO_VBI_GPCNT) - 1;
-	ctrl_iowrite32(dev, MO_PCI_INTMSK, 1);
+	mutex_lock(&dev->vdev_mlock);
+	head = cx88sdr_ring_head(dev);
+	if (dev->start_oldest)
+		head -= VBI_DMA_PAGES - CX88SDR_RING_GUARD;
+	/* During the first lap after probe the older pages were never written */
+	head = max(head, dev->ring_first);
+	fh->start = head << PAGE_SHIFT;
+	spin_lock_irqsave(&dev->fh_lock, flags);
+	list_add_tail(&fh->list, &dev->fh_list);
+	spin_unlock_irqrestore(&dev->fh_lock, flags);
+	/* The RISC IRQ wakes up readers, keep it on while anyone listens */
+	if (!dev->users++)
+		ctrl_iowrite32(dev, MO_PCI_INTMSK, 1);
+	mutex_unlock(&dev->vdev_mlock);
 	return 0;
 }
 
@@ -122,64 +183,413 @@ static int cx88sdr_release(struct file *file)
 	struct v4l2_fh *vfh = file->private_data;
 	struct cx88sdr_fh *fh = container_of(vfh, struct cx88sdr_fh, fh);
 	struct cx88sdr_dev *dev = fh->dev;
+	unsigned long flags;
 
-	ctrl_iowrite32(dev, MO_PCI_INTMSK, 0);
+	mutex_lock(&dev->vdev_mlock);
+	spin_lock_irqsave(&dev->fh_lock, flags);
+	list_del(&fh->list);
+	spin_unlock_irqrestore(&dev->fh_lock, flags);
+	if (!--dev->users)
+		ctrl_iowrite32(dev, MO_PCI_INTMSK, 0);
+	mutex_unlock(&dev->vdev_mlock);
 
 	v4l2_fh_del(&fh->fh);
 	v4l2_fh_exit(&fh->fh);
+	v4l2_ctrl_handler_free(&fh->ctrl_handler);
 	kfree(fh);
 	return 0;
 }
 
-static ssize_t cx88sdr_read(struct file *file, char __user *buf, size_t size,
-			    loff_t *pos)
+static u32 cx88sdr_sample_rate(struct cx88sdr_dev *dev)
+{
+	switch (dev->pixelformat) {
+	case V4L2_SDR_FMT_RU16LE:
+		return cx88sdr_bands_ru16[dev->sdr_band].rangelow;
+	default:
+		return cx88sdr_bands_ru08[dev->sdr_band].rangelow;
+	}
+}
+
+static u32 cx88sdr_byte_rate(struct cx88sdr_dev *dev)
+{
+	if (dev->pixelformat == V4L2_SDR_FMT_RU16LE)
+		return cx88sdr_sample_rate(dev) * 2;
+	return cx88sdr_sample_rate(dev);
+}
+
+/* A complex handle sees the ADC width as CS8/CS16LE at half the rate */
+static u32 cx88sdr_fh_format(struct cx88sdr_fh *fh, u32 pixelformat)
+{
+	if (!READ_ONCE(fh->complex))
+		return pixelformat;
+	return (pixelformat == V4L2_SDR_FMT_RU16LE) ?
+	       V4L2_SDR_FMT_CS16LE : V4L2_SDR_FMT_CS8;
+}
+
+/* The ring bytes at seq, synced for the CPU in streaming mode */
+static const u8 *cx88sdr_ring_get(struct cx88sdr_dev *dev, u64 seq, u32 len)
+{
+	u32 page = (seq >> PAGE_SHIFT) & (VBI_DMA_PAGES - 1);
+	u32 offset = seq & (PAGE_SIZE - 1);
+
+	if (dev->dma_streaming)
+		dma_sync_single_range_for_cpu(&dev->pdev->dev,
+					      dev->dma_pages_addr[page],
+					      offset, len, DMA_FROM_DEVICE);
+	return (const u8 *)dev->dma_buf_pages[page] + offset;
+}
+
+/* Other handles and the stats pass read the same pages, leave them intact */
+static void cx88sdr_ring_put(struct cx88sdr_dev *dev, u64 seq, u32 len)
+{
+	u32 page = (seq >> PAGE_SHIFT) & (VBI_DMA_PAGES - 1);
+
+	if (dev->dma_streaming)
+		dma_sync_single_range_for_device(&dev->pdev->dev,
+						 dev->dma_pages_addr[page],
+						 seq & (PAGE_SIZE - 1), len,
+						 DMA_FROM_DEVICE);
+}
+
+static void cx88sdr_ddc_run(struct cx88sdr_fh *fh, const u8 *in, u32 pairs, bool wide)
+{
+	if (wide)
+		ddc_load_u16(&fh->ddc, (const __le16 *)in, pairs);
+	else
+		ddc_load_u8(&fh->ddc, in, pairs);
+	ddc_filter(&fh->ddc, pairs);
+}
+
+/*
+ * Restart the DDC at seq, fed with the pairs right before it. The mixer
+ * phase follows the ring, so every handle computes the same samples. After
+ * a skip those pairs may be stale and the first outputs settle.
+ */
+static void cx88sdr_ddc_prime(struct cx88sdr_fh *fh, u64 seq, bool wide)
+{
+	u32 shift = wide ? 2 : 1, len;
+	u64 s = seq - (CX88SDR_DDC_PRIME << shift);
+
+	ddc_reset(&fh->ddc);
+	fh->ddc.phase = s >> shift;
+	for (; s < seq; s += len) {
+		len = min_t(u64, seq - s, PAGE_SIZE - (s & (PAGE_SIZE - 1)));
+		cx88sdr_ddc_run(fh, cx88sdr_ring_get(fh->dev, s, len), len >> shift, wide);
+		cx88sdr_ring_put(fh->dev, s, len);
+	}
+	fh->ddc_wide = wide;
+}
+
+/*
+ * Mix, filter and decimate [seq, seq + len) into the user buffer. An output
+ * pair takes as many bytes as an input pair, stream offsets stay the same.
+ */
+static int cx88sdr_copy_ddc(struct cx88sdr_fh *fh, char __user *buf, u64 seq,
+			    u32 len, bool wide)
 {
-	struct v4l2_fh *vfh = file->private_data;
-	struct cx88sdr_fh *fh = container_of(vfh, struct cx88sdr_fh, fh);
 	struct cx88sdr_dev *dev = fh->dev;
-	ssize_t result = 0;
-	uint32_t page, page_cnt;
+	u32 shift = wide ? 2 : 1;
+	int ret = 0;
+
+	mutex_lock(&fh->ddc_lock);
+	if (fh->ddc_seq != seq || fh->ddc_wide != wide)
+		cx88sdr_ddc_prime(fh, seq, wide);
+
+	while (len) {
+		u32 pairs = min_t(u32, len >> shift, DDC_BLOCK);
+		u32 bytes = pairs << shift;
+
+		cx88sdr_ddc_run(fh, cx88sdr_ring_get(dev, seq, bytes), pairs, wide);
+		cx88sdr_ring_put(dev, seq, bytes);
+		if (wide)
+			ddc_store_cs16(&fh->ddc, (__le16 *)fh->ddc_out, pairs);
+		else
+			ddc_store_cs8(&fh->ddc, (s8 *)fh->ddc_out, pairs);
+
+		if (copy_to_user(buf, fh->ddc_out, bytes)) {
+			ret = -EFAULT;
+			break;
+		}
+		seq += bytes;
+		buf += bytes;
+		len -= bytes;
+	}
+	/* After a fault the position does not advance, prime again */
+	fh->ddc_seq = ret ? 0 : seq;
+	mutex_unlock(&fh->ddc_lock);
+	return ret;
+}
+
+/* Move the cursor forward, the reader learns about it through an event */
+static void cx88sdr_skip(struct cx88sdr_fh *fh, loff_t *pos, u64 len)
+{
+	struct v4l2_event ev = {
+		.type = V4L2_EVENT_CX88SDR_DISCONTINUITY,
+	};
+	struct v4l2_event_cx88sdr_discontinuity *disc = (void *)ev.u.data;
+
+	*pos += len;
+	fh->skipped += len;
+
+	disc->offset = *pos;
+	disc->skipped = len;
+	v4l2_event_queue_fh(&fh->fh, &ev);
+}
+
+/* Jump to the newest complete page once the reader lags too far behind */
+static void cx88sdr_live_edge(struct cx88sdr_fh *fh, loff_t *pos, u64 head)
+{
+	u32 max_latency = READ_ONCE(fh->max_latency);
+	u64 pos_seq = fh->start + *pos, live_seq, max_lag;
+
+	if (!max_latency)
+		return;
+
+	max_lag = div_u64((u64)max_latency * cx88sdr_byte_rate(fh->dev),
+			  USEC_PER_SEC);
+	if ((head << PAGE_SHIFT) - pos_seq <= max_lag)
+		return;
+
+	live_seq = (head - 1) << PAGE_SHIFT;
+	if (live_seq > pos_seq)
+		cx88sdr_skip(fh, pos, live_seq - pos_seq);
+}
+
+/*
+ * Pages are never marked as consumed, the absolute page numbers tell it all:
+ * the writer starts on the ring slot of page again at page + VBI_DMA_PAGES.
+ * True once that may have happened by head.
+ */
+static bool cx88sdr_lapped(u64 head, u64 page)
+{
+	return head + CX88SDR_LAP_MARGIN >= page + VBI_DMA_PAGES;
+}
+
+/* The writer caught up with the reader, resume where it is safe again */
+static void cx88sdr_overrun(struct cx88sdr_fh *fh, loff_t *pos, u64 head)
+{
+	u64 seq = fh->start + *pos;
+	u64 safe = (head + CX88SDR_RING_GUARD - VBI_DMA_PAGES) << PAGE_SHIFT;
+
+	atomic64_inc(&fh->dev->overruns);
+	if (safe > seq)
+		cx88sdr_skip(fh, pos, safe - seq);
+}
+
+/*
+ * Where the segment holding seq continues with the wanted input, skipping
+ * mixed spans and segments of other inputs. U64_MAX if that input has not
+ * come up again yet. *end is where the returned segment stops.
+ */
+static u64 cx88sdr_segment(struct cx88sdr_dev *dev, u32 input, u64 seq, u64 *end)
+{
+	const struct cx88sdr_segment *seg;
+	unsigned long flags;
+	u64 i, oldest, next;
+
+	*end = U64_MAX;
+
+	spin_lock_irqsave(&dev->seg_lock, flags);
+	oldest = (dev->seg_cnt > CX88SDR_SEGMENTS) ?
+		 (dev->seg_cnt - CX88SDR_SEGMENTS) : 0;
+
+	/* Segment i - 1 starts at or before seq */
+	for (i = dev->seg_cnt; i > oldest; i--)
+		if (dev->seg[(i - 1) & (CX88SDR_SEGMENTS - 1)].first <= seq)
+			break;
+	if (i == oldest) {
+		/* Older than the history, resume with what is known */
+		seq = dev->seg[oldest & (CX88SDR_SEGMENTS - 1)].first;
+		i++;
+	}
+
+	for (; i <= dev->seg_cnt; i++) {
+		seg = &dev->seg[(i - 1) & (CX88SDR_SEGMENTS - 1)];
+		next = (i < dev->seg_cnt) ?
+		       dev->seg[i & (CX88SDR_SEGMENTS - 1)].first : U64_MAX;
+
+		if (seg->input == input && max(seq, seg->clean) < next) {
+			seq = max(seq, seg->clean);
+			*end = next;
+			break;
+		}
+		seq = next;
+	}
+	spin_unlock_irqrestore(&dev->seg_lock, flags);
 
-	page = (dev->start_page + ((*pos % VBI_DMA_SIZE) >> PAGE_SHIFT)) %
-		VBI_DMA_PAGES;
+	return seq;
+}
+
+/*
+ * Where seq continues past the holes of DMA restarts still in the history.
+ * *end is where the next hole starts, U64_MAX if there is none.
+ */
+static u64 cx88sdr_unfiltered(struct cx88sdr_dev *dev, u64 seq, u64 *end)
+{
+	const struct cx88sdr_segment *seg;
+	unsigned long flags;
+	u64 i, oldest;
+
+	*end = U64_MAX;
+
+	spin_lock_irqsave(&dev->seg_lock, flags);
+	oldest = (dev->seg_cnt > CX88SDR_SEGMENTS) ?
+		 (dev->seg_cnt - CX88SDR_SEGMENTS) : 0;
+
+	/*
+	 * From the segment holding seq on, a restart moves the head to the
+	 * end of its hole, so no later segment starts inside an earlier hole.
+	 */
+	for (i = dev->seg_cnt; i > oldest + 1; i--)
+		if (dev->seg[(i - 1) & (CX88SDR_SEGMENTS - 1)].first <= seq)
+			break;
+
+	for (i--; i < dev->seg_cnt; i++) {
+		seg = &dev->seg[i & (CX88SDR_SEGMENTS - 1)];
+		if (!seg->hole || seg->clean <= seq)
+			continue;
+		if (seq < seg->first) {
+			*end = seg->first;
+			break;
+		}
+		seq = seg->clean;
+	}
+	spin_unlock_irqrestore(&dev->seg_lock, flags);
 
-retry:
-	page_cnt = ctrl_ioread32(dev, MO_VBI_GPCNT);
-	page_cnt = (!page_cnt) ? (VBI_DMA_PAGES - 1) : (page_cnt - 1);
+	return seq;
+}
 
-	if ((page == page_cnt) && (file->f_flags & O_NONBLOCK))
-		return -EAGAIN;
+/* Ring byte sequence the handle reads next and where its segment ends */
+static u64 cx88sdr_next(struct cx88sdr_fh *fh, loff_t pos, u64 *end)
+{
+	u32 input_filter = READ_ONCE(fh->input_filter);
+	u64 seq = fh->start + pos;
 
-	while (size && page != page_cnt) {
-		u32 len;
+	/* The filter also covers DMA restarts, they are logged as segments */
+	if (input_filter)
+		return cx88sdr_segment(fh->dev, input_filter - 1, seq, end);
 
-		/* Handle partial pages */
-		len = (*pos % PAGE_SIZE) ? (PAGE_SIZE - (*pos % PAGE_SIZE)) : PAGE_SIZE;
-		if (len > size)
-			len = size;
+	return cx88sdr_unfiltered(fh->dev, seq, end);
+}
 
-		if (copy_to_user(buf, dev->dma_buf_pages[page] + (*pos % PAGE_SIZE), len))
-			return -EFAULT;
+static bool cx88sdr_readable(struct cx88sdr_fh *fh, loff_t pos)
+{
+	u64 end, next = cx88sdr_next(fh, pos, &end);
 
-		memset(dev->dma_buf_pages[page] + (*pos % PAGE_SIZE), 0, len);
+	return next != U64_MAX &&
+	       (next >> PAGE_SHIFT) < cx88sdr_ring_head(fh->dev);
+}
 
-		result += len;
-		buf    += len;
-		*pos   += len;
-		size   -= len;
-		page    = (dev->start_page + ((*pos % VBI_DMA_SIZE) >> PAGE_SHIFT)) %
-			   VBI_DMA_PAGES;
+static ssize_t cx88sdr_read(struct file *file, char __user *buf, size_t size,
+			    loff_t *pos)
+{
+	struct v4l2_fh *vfh = file->private_data;
+	struct cx88sdr_fh *fh = container_of(vfh, struct cx88sdr_fh, fh);
+	struct cx88sdr_dev *dev = fh->dev;
+	bool complex = READ_ONCE(fh->complex), wide = false;
+	ssize_t result = 0;
+	u64 head, next, end;
+	u32 unit = 1;
+	long ret;
+
+	if (complex) {
+		unit = (READ_ONCE(dev->pixelformat) == V4L2_SDR_FMT_RU16LE) ? 4 : 2;
+		if (size < unit)
+			return -EINVAL;
+		size -= size % unit;
 	}
 
-	if (size && !(file->f_flags & O_NONBLOCK))
-		goto retry;
+	while (size) {
+		if (!cx88sdr_readable(fh, *pos)) {
+			if (file->f_flags & O_NONBLOCK)
+				return result ? result : -EAGAIN;
+
+			/* Sleep until the RISC IRQ reports more pages */
+			ret = wait_event_interruptible_timeout(dev->read_wq,
+					cx88sdr_readable(fh, *pos),
+					CX88SDR_READ_TIMEOUT);
+			if (ret < 0)
+				return result ? result : ret;
+			continue;
+		}
+
+		head = cx88sdr_ring_head(dev);
+		cx88sdr_live_edge(fh, pos, head);
+
+		next = cx88sdr_next(fh, *pos, &end);
+		if (next == U64_MAX)
+			continue;
+		if (next > fh->start + *pos)
+			cx88sdr_skip(fh, pos, next - (fh->start + *pos));
+		if (cx88sdr_lapped(head, (fh->start + *pos) >> PAGE_SHIFT)) {
+			cx88sdr_overrun(fh, pos, head);
+			continue;
+		}
+
+		/* Complex output comes in whole I/Q pairs, the width may have changed */
+		if (complex) {
+			wide = READ_ONCE(dev->pixelformat) == V4L2_SDR_FMT_RU16LE;
+			unit = wide ? 4 : 2;
+			if (size < unit)
+				break;
+			if (*pos % unit)
+				cx88sdr_skip(fh, pos, unit - *pos % unit);
+		}
+
+		while (size >= unit && fh->start + *pos < end &&
+		       ((fh->start + *pos) >> PAGE_SHIFT) < head) {
+			u64 seq = fh->start + *pos;
+			u32 len;
+
+			/* Handle partial pages */
+			len = (*pos % PAGE_SIZE) ? (PAGE_SIZE - (*pos % PAGE_SIZE)) : PAGE_SIZE;
+			if (len > size)
+				len = size;
+			if (len > end - seq)
+				len = end - seq;
+			len -= len % unit;
+
+			if (complex) {
+				ret = cx88sdr_copy_ddc(fh, buf, seq, len, wide);
+			} else {
+				const u8 *p = cx88sdr_ring_get(dev, seq, len);
+
+				ret = copy_to_user(buf, p, len) ? -EFAULT : 0;
+				/* Debug, the write traffic reads used to cost */
+				if (dev->zero_read)
+					memset((void *)p, 0, len);
+				cx88sdr_ring_put(dev, seq, len);
+			}
+			if (ret)
+				return result ? result : ret;
+
+			/* Overwritten while copying, drop it and skip ahead */
+			if (cx88sdr_lapped(cx88sdr_ring_seen(dev), seq >> PAGE_SHIFT))
+				break;
+
+			result += len;
+			buf    += len;
+			*pos   += len;
+			size   -= len;
+		}
+	}
 
+	if (!result && size)
+		return -EINVAL;
 	return result;
 }
 
 static __poll_t cx88sdr_poll(struct file *file, struct poll_table_struct *wait)
 {
-	return (EPOLLIN | EPOLLRDNORM | v4l2_ctrl_poll(file, wait));
+	struct v4l2_fh *vfh = file->private_data;
+	struct cx88sdr_fh *fh = container_of(vfh, struct cx88sdr_fh, fh);
+	struct cx88sdr_dev *dev = fh->dev;
+	__poll_t res = v4l2_ctrl_poll(file, wait);
+
+	poll_wait(file, &dev->read_wq, wait);
+	if (cx88sdr_readable(fh, file->f_pos))
+		res |= (EPOLLIN | EPOLLRDNORM);
+	return res;
 }
 
 static const struct v4l2_file_operations cx88sdr_fops = {
@@ -213,6 +623,14 @@ static int cx88sdr_enum_fmt_sdr(struct file __always_unused *file,
 	case 1:
 		f->pixelformat = V4L2_SDR_FMT_RU16LE;
 		break;
+	case 2:
+		f->pixelformat = V4L2_SDR_FMT_CS8;
+		break;
+	case 3:
+		/* Not known to the V4L2 core, which needs a description */
+		f->pixelformat = V4L2_SDR_FMT_CS16LE;
+		strscpy(f->description, "Complex S16LE", sizeof(f->description));
+		break;
 	default:
 		return -EINVAL;
 	}
@@ -230,6 +648,8 @@ static int cx88sdr_try_fmt_sdr(struct file *file, void __always_unused *priv,
 		f->fmt.sdr.buffersize = dev->buffersize;
 		break;
 	case V4L2_SDR_FMT_RU16LE:
+	case V4L2_SDR_FMT_CS8:
+	case V4L2_SDR_FMT_CS16LE:
 		f->fmt.sdr.buffersize = dev->buffersize;
 		break;
 	default:
@@ -246,7 +666,7 @@ static int cx88sdr_g_fmt_sdr(struct file *file, void __always_unused *priv,
 	struct cx88sdr_dev *dev = video_drvdata(file);
 
 	memset(f->fmt.sdr.reserved, 0, sizeof(f->fmt.sdr.reserved));
-	f->fmt.sdr.pixelformat = dev->pixelformat;
+	f->fmt.sdr.pixelformat = cx88sdr_fh_format(cx88sdr_file_fh(file), dev->pixelformat);
 	f->fmt.sdr.buffersize = dev->buffersize;
 	return 0;
 }
@@ -255,15 +675,22 @@ static int cx88sdr_s_fmt_sdr(struct file *file, void __always_unused *priv,
 			     struct v4l2_format *f)
 {
 	struct cx88sdr_dev *dev = video_drvdata(file);
+	struct cx88sdr_fh *fh = cx88sdr_file_fh(file);
+	u32 pixelformat = dev->pixelformat;
+	unsigned long flags;
+	int ret;
 
 	memset(f->fmt.sdr.reserved, 0, sizeof(f->fmt.sdr.reserved));
 
+	/* The ADC width is shared, real or complex output is per handle */
 	switch (f->fmt.sdr.pixelformat) {
 	case V4L2_SDR_FMT_RU8:
+	case V4L2_SDR_FMT_CS8:
 		dev->pixelformat = V4L2_SDR_FMT_RU8;
 		f->fmt.sdr.buffersize = dev->buffersize;
 		break;
 	case V4L2_SDR_FMT_RU16LE:
+	case V4L2_SDR_FMT_CS16LE:
 		dev->pixelformat = V4L2_SDR_FMT_RU16LE;
 		f->fmt.sdr.buffersize = dev->buffersize;
 		break;
@@ -273,13 +700,22 @@ static int cx88sdr_s_fmt_sdr(struct file *file, void __always_unused *priv,
 		f->fmt.sdr.buffersize = dev->buffersize;
 		break;
 	}
-	return cx88sdr_adc_fmt_set(dev);
+	WRITE_ONCE(fh->complex, f->fmt.sdr.pixelformat == V4L2_SDR_FMT_CS8 ||
+				f->fmt.sdr.pixelformat == V4L2_SDR_FMT_CS16LE);
+	if (dev->pixelformat == pixelformat)
+		return 0;
+
+	spin_lock_irqsave(&dev->seg_lock, flags);
+	ret = cx88sdr_reconfig(dev, true);
+	spin_unlock_irqrestore(&dev->seg_lock, flags);
+	return ret;
 }
 
 static int cx88sdr_g_tuner(struct file *file, void __always_unused *priv,
 			   struct v4l2_tuner *t)
 {
 	struct cx88sdr_dev *dev = video_drvdata(file);
+	struct cx88sdr_fh *fh = cx88sdr_file_fh(file);
 
 	if (t->index > 0)
 		return -EINVAL;
@@ -296,6 +732,8 @@ static int cx88sdr_g_tuner(struct file *file, void __always_unused *priv,
 	default:
 		return -EINVAL;
 	}
+	t->rangelow  >>= fh->complex;
+	t->rangehigh >>= fh->complex;
 	strscpy(t->name, "ADC: CX2388x SDR", sizeof(t->name));
 	t->type = V4L2_TUNER_SDR;
 	t->capability = (V4L2_TUNER_CAP_1HZ | V4L2_TUNER_CAP_FREQ_BANDS);
@@ -316,6 +754,7 @@ static int cx88sdr_enum_freq_bands(struct file *file, void __always_unused *priv
 				   struct v4l2_frequency_band *band)
 {
 	struct cx88sdr_dev *dev = video_drvdata(file);
+	struct cx88sdr_fh *fh = cx88sdr_file_fh(file);
 
 	if (band->tuner > 0 || band->index > CX88SDR_BAND_02)
 		return -EINVAL;
@@ -330,6 +769,8 @@ static int cx88sdr_enum_freq_bands(struct file *file, void __always_unused *priv
 	default:
 		return -EINVAL;
 	}
+	band->rangelow  >>= fh->complex;
+	band->rangehigh >>= fh->complex;
 	return 0;
 }
 
@@ -337,6 +778,7 @@ static int cx88sdr_g_frequency(struct file *file, void __always_unused *priv,
 			       struct v4l2_frequency *f)
 {
 	struct cx88sdr_dev *dev = video_drvdata(file);
+	struct cx88sdr_fh *fh = cx88sdr_file_fh(file);
 
 	if (f->tuner > 0)
 		return -EINVAL;
@@ -351,6 +793,7 @@ static int cx88sdr_g_frequency(struct file *file, void __always_unused *priv,
 	default:
 		return -EINVAL;
 	}
+	f->frequency >>= fh->complex;
 	f->type = V4L2_TUNER_SDR;
 	return 0;
 }
@@ -359,39 +802,202 @@ static int cx88sdr_s_frequency(struct file *file, void __always_unused *priv,
 			       const struct v4l2_frequency *f)
 {
 	struct cx88sdr_dev *dev = video_drvdata(file);
+	struct cx88sdr_fh *fh = cx88sdr_file_fh(file);
+	u32 sdr_band = dev->sdr_band;
+	unsigned long flags;
+	u64 frequency;
+	int ret;
 
 	if (f->tuner > 0 || f->type != V4L2_TUNER_SDR)
 		return -EINVAL;
 
+	/* Bands are selected by the real rate */
+	frequency = (u64)f->frequency << fh->complex;
+
 	switch (dev->pixelformat) {
 	case V4L2_SDR_FMT_RU8:
 		if      (dev->sdr_band != CX88SDR_BAND_00 &&
-			 f->frequency   < cx88sdr_bands_ru08[CX88SDR_BAND_01].rangelow)
+			 frequency      < cx88sdr_bands_ru08[CX88SDR_BAND_01].rangelow)
 			dev->sdr_band   = CX88SDR_BAND_00;
 		else if (dev->sdr_band != CX88SDR_BAND_01 &&
-			 f->frequency   > cx88sdr_bands_ru08[CX88SDR_BAND_00].rangehigh &&
-			 f->frequency   < cx88sdr_bands_ru08[CX88SDR_BAND_02].rangelow)
+			 frequency      > cx88sdr_bands_ru08[CX88SDR_BAND_00].rangehigh &&
+			 frequency      < cx88sdr_bands_ru08[CX88SDR_BAND_02].rangelow)
 			dev->sdr_band   = CX88SDR_BAND_01;
 		else if (dev->sdr_band != CX88SDR_BAND_02 &&
-			 f->frequency   > cx88sdr_bands_ru08[CX88SDR_BAND_01].rangehigh)
+			 frequency      > cx88sdr_bands_ru08[CX88SDR_BAND_01].rangehigh)
 			dev->sdr_band   = CX88SDR_BAND_02;
 		break;
 	case V4L2_SDR_FMT_RU16LE:
 		if      (dev->sdr_band != CX88SDR_BAND_00 &&
-			 f->frequency   < cx88sdr_bands_ru16[CX88SDR_BAND_01].rangelow)
+			 frequency      < cx88sdr_bands_ru16[CX88SDR_BAND_01].rangelow)
 			dev->sdr_band   = CX88SDR_BAND_00;
 		else if (dev->sdr_band != CX88SDR_BAND_01 &&
-			 f->frequency   > cx88sdr_bands_ru16[CX88SDR_BAND_00].rangehigh &&
-			 f->frequency   < cx88sdr_bands_ru16[CX88SDR_BAND_02].rangelow)
+			 frequency      > cx88sdr_bands_ru16[CX88SDR_BAND_00].rangehigh &&
+			 frequency      < cx88sdr_bands_ru16[CX88SDR_BAND_02].rangelow)
 			dev->sdr_band   = CX88SDR_BAND_01;
 		else if (dev->sdr_band != CX88SDR_BAND_02 &&
-			 f->frequency   > cx88sdr_bands_ru16[CX88SDR_BAND_01].rangehigh)
+			 frequency      > cx88sdr_bands_ru16[CX88SDR_BAND_01].rangehigh)
 			dev->sdr_band   = CX88SDR_BAND_02;
 		break;
 	default:
 		return -EINVAL;
 	}
-	return cx88sdr_adc_fmt_set(dev);
+	if (dev->sdr_band == sdr_band)
+		return 0;
+
+	spin_lock_irqsave(&dev->seg_lock, flags);
+	ret = cx88sdr_reconfig(dev, true);
+	spin_unlock_irqrestore(&dev->seg_lock, flags);
+	return ret;
+}
+
+struct cx88sdr_stats {
+	u64 sum;
+	u64 sumsq;
+	u32 samples;
+	u32 clipped;
+	u32 min;
+	u32 max;
+};
+
+/* Square root of a 64-bit value, brought into 32 bits by even shifts first */
+static u32 cx88sdr_sqrt64(u64 x)
+{
+	unsigned int shift = 0;
+
+	while (x >> 32) {
+		x >>= 2;
+		shift++;
+	}
+	return int_sqrt(x) << shift;
+}
+
+static void cx88sdr_stats_ru08(struct cx88sdr_stats *st, const u8 *p, u32 n)
+{
+	u32 i;
+
+	for (i = 0; i < n; i++) {
+		u32 v = p[i];
+
+		st->sum += v;
+		st->sumsq += v * v;
+		st->clipped += (v == 0 || v == U8_MAX);
+		st->min = min(st->min, v);
+		st->max = max(st->max, v);
+	}
+	st->samples += n;
+}
+
+static void cx88sdr_stats_ru16(struct cx88sdr_stats *st, const u16 *p, u32 n)
+{
+	u32 i;
+
+	for (i = 0; i < n; i++) {
+		u32 v = le16_to_cpu((__force __le16)p[i]);
+
+		st->sum += v;
+		st->sumsq += v * v;
+		st->clipped += (v == 0 || v == U16_MAX);
+		st->min = min(st->min, v);
+		st->max = max(st->max, v);
+	}
+	st->samples += n;
+}
+
+/* Runs after a RISC IRQ, analyzes the newest complete pages */
+void cx88sdr_stats_work(struct work_struct *work)
+{
+	struct cx88sdr_dev *dev = container_of(work, struct cx88sdr_dev, stats_work);
+	struct cx88sdr_stats st = { .min = U32_MAX };
+	struct v4l2_event ev = {
+		.type = V4L2_EVENT_CX88SDR_STATS,
+	};
+	struct v4l2_event_cx88sdr_stats *es = (void *)ev.u.data;
+	u32 pixelformat = dev->pixelformat, mid, n;
+	u64 head, seq, var;
+	struct cx88sdr_fh *fh;
+	unsigned long flags;
+	s64 mean;
+
+	head = cx88sdr_ring_head(dev);
+	if (head < dev->stats_head + CX88SDR_STATS_PAGES)
+		return;
+	dev->stats_head = head;
+	seq = (head - CX88SDR_STATS_PAGES) << PAGE_SHIFT;
+
+	for (n = 0; n < CX88SDR_STATS_PAGES; n++) {
+		u32 page = ((seq >> PAGE_SHIFT) + n) & (VBI_DMA_PAGES - 1);
+
+		if (dev->dma_streaming)
+			dma_sync_single_for_cpu(&dev->pdev->dev, dev->dma_pages_addr[page],
+						PAGE_SIZE, DMA_FROM_DEVICE);
+		if (pixelformat == V4L2_SDR_FMT_RU16LE)
+			cx88sdr_stats_ru16(&st, dev->dma_buf_pages[page], PAGE_SIZE / 2);
+		else
+			cx88sdr_stats_ru08(&st, dev->dma_buf_pages[page], PAGE_SIZE);
+		if (dev->dma_streaming)
+			dma_sync_single_for_device(&dev->pdev->dev, dev->dma_pages_addr[page],
+						   PAGE_SIZE, DMA_FROM_DEVICE);
+	}
+
+	/* Q8 mean and Q16 variance, the sums leave enough headroom in 64 bits */
+	mid = (pixelformat == V4L2_SDR_FMT_RU16LE) ? 0x8000 : 0x80;
+	mean = div_u64(st.sum << 8, st.samples);
+	var = div_u64(st.sumsq << 16, st.samples) - mean * mean;
+
+	es->samples = st.samples;
+	es->clipped = st.clipped;
+	es->min = st.min;
+	es->max = st.max;
+	es->mean = mean - (mid << 8);
+	es->rms = cx88sdr_sqrt64(var);
+	es->input = dev->input;
+
+	spin_lock_irqsave(&dev->fh_lock, flags);
+	list_for_each_entry(fh, &dev->fh_list, list) {
+		if (seq < fh->start)
+			continue;
+		es->offset = seq - fh->start;
+		v4l2_event_queue_fh(&fh->fh, &ev);
+	}
+	spin_unlock_irqrestore(&dev->fh_lock, flags);
+}
+
+static int cx88sdr_stats_add(struct v4l2_subscribed_event *sev,
+			     unsigned int __always_unused elems)
+{
+	struct cx88sdr_dev *dev = container_of(sev->fh->vdev, struct cx88sdr_dev, vdev);
+
+	atomic_inc(&dev->stats_users);
+	return 0;
+}
+
+static void cx88sdr_stats_del(struct v4l2_subscribed_event *sev)
+{
+	struct cx88sdr_dev *dev = container_of(sev->fh->vdev, struct cx88sdr_dev, vdev);
+
+	atomic_dec(&dev->stats_users);
+}
+
+static const struct v4l2_subscribed_event_ops cx88sdr_stats_ops = {
+	.add	= cx88sdr_stats_add,
+	.del	= cx88sdr_stats_del,
+};
+
+static int cx88sdr_subscribe_event(struct v4l2_fh *fh,
+				   const struct v4l2_event_subscription *sub)
+{
+	switch (sub->type) {
+	case V4L2_EVENT_CX88SDR_DISCONTINUITY:
+	case V4L2_EVENT_CX88SDR_RECONFIG:
+	case V4L2_EVENT_CX88SDR_RECOVERY:
+		return v4l2_event_subscribe(fh, sub, CX88SDR_EVENT_QUEUE_LEN, NULL);
+	case V4L2_EVENT_CX88SDR_STATS:
+		return v4l2_event_subscribe(fh, sub, CX88SDR_EVENT_QUEUE_LEN,
+					    &cx88sdr_stats_ops);
+	default:
+		return v4l2_ctrl_subscribe_event(fh, sub);
+	}
 }
 
 static const struct v4l2_ioctl_ops cx88sdr_ioctl_ops = {
@@ -406,7 +1012,7 @@ static const struct v4l2_ioctl_ops cx88sdr_ioctl_ops = {
 	.vidioc_g_frequency		= cx88sdr_g_frequency,
 	.vidioc_s_frequency		= cx88sdr_s_frequency,
 	.vidioc_log_status		= v4l2_ctrl_log_status,
-	.vidioc_subscribe_event		= v4l2_ctrl_subscribe_event,
+	.vidioc_subscribe_event		= cx88sdr_subscribe_event,
 	.vidioc_unsubscribe_event	= v4l2_event_unsubscribe,
 };
 
@@ -474,10 +1080,154 @@ int cx88sdr_adc_fmt_set(struct cx88sdr_dev *dev)
 	return 0;
 }
 
+/* Tell every reader where the new configuration starts, in its own offsets */
+static void cx88sdr_queue_reconfig(struct cx88sdr_dev *dev, u64 first, u64 clean)
+{
+	struct v4l2_event ev = {
+		.type = V4L2_EVENT_CX88SDR_RECONFIG,
+	};
+	struct v4l2_event_cx88sdr_reconfig *rc = (void *)ev.u.data;
+	struct cx88sdr_fh *fh;
+	unsigned long flags;
+
+	rc->input = dev->input;
+
+	spin_lock_irqsave(&dev->fh_lock, flags);
+	list_for_each_entry(fh, &dev->fh_list, list) {
+		if (clean <= fh->start)
+			continue;
+		rc->pixelformat = cx88sdr_fh_format(fh, dev->pixelformat);
+		rc->rate = cx88sdr_sample_rate(dev) >> READ_ONCE(fh->complex);
+		rc->offset = clean - fh->start;
+		rc->mixed = clean - max(first, fh->start);
+		v4l2_event_queue_fh(&fh->fh, &ev);
+	}
+	spin_unlock_irqrestore(&dev->fh_lock, flags);
+}
+
+/*
+ * Rate, format and input changes land while DMA runs. Pages completed before
+ * the register writes are clean, the page in flight and whatever still sits
+ * in the SRAM clusters are mixed, the first page after that is clean again.
+ * Input only changes leave the ADC clock alone. Called with seg_lock held, the
+ * caller decides on the new settings under the same lock.
+ */
+int cx88sdr_reconfig(struct cx88sdr_dev *dev, bool adc)
+{
+	struct cx88sdr_segment *seg;
+	u64 first, clean;
+	int ret = 0;
+
+	lockdep_assert_held(&dev->seg_lock);
+
+	first = cx88sdr_ring_head(dev);
+	cx88sdr_input_set(dev);
+	if (adc)
+		ret = cx88sdr_adc_fmt_set(dev);
+	clean = cx88sdr_ring_head(dev) + 1 + CX88SDR_FIFO_PAGES(dev);
+
+	seg = &dev->seg[dev->seg_cnt++ & (CX88SDR_SEGMENTS - 1)];
+	seg->first = first << PAGE_SHIFT;
+	seg->clean = clean << PAGE_SHIFT;
+	seg->input = dev->input;
+	seg->hole = false;
+
+	cx88sdr_queue_reconfig(dev, seg->first, seg->clean);
+
+	return ret;
+}
+
+/* Called with seg_lock held after a DMA restart, first and clean as in reconfig */
+void cx88sdr_queue_recovery(struct cx88sdr_dev *dev, u64 first, u64 clean,
+			    u32 status)
+{
+	struct v4l2_event ev = {
+		.type = V4L2_EVENT_CX88SDR_RECOVERY,
+	};
+	struct v4l2_event_cx88sdr_recovery *rec = (void *)ev.u.data;
+	struct cx88sdr_segment *seg;
+	struct cx88sdr_fh *fh;
+	unsigned long flags;
+
+	seg = &dev->seg[dev->seg_cnt++ & (CX88SDR_SEGMENTS - 1)];
+	seg->first = first;
+	seg->clean = clean;
+	seg->input = dev->input;
+	seg->hole = true;
+
+	rec->status = status;
+	rec->count = atomic64_read(&dev->recoveries);
+
+	spin_lock_irqsave(&dev->fh_lock, flags);
+	list_for_each_entry(fh, &dev->fh_list, list) {
+		if (clean <= fh->start)
+			continue;
+		rec->offset = clean - fh->start;
+		rec->lost = clean - max(first, fh->start);
+		v4l2_event_queue_fh(&fh->fh, &ev);
+	}
+	spin_unlock_irqrestore(&dev->fh_lock, flags);
+}
+
+/* The watchdog gave up on the DMA, nothing follows the current head */
+void cx88sdr_queue_stopped(struct cx88sdr_dev *dev, u32 status)
+{
+	struct v4l2_event ev = {
+		.type = V4L2_EVENT_CX88SDR_RECOVERY,
+	};
+	struct v4l2_event_cx88sdr_recovery *rec = (void *)ev.u.data;
+	u64 seq = cx88sdr_ring_head(dev) << PAGE_SHIFT;
+	struct cx88sdr_fh *fh;
+	unsigned long flags;
+
+	rec->status = status;
+	rec->count = atomic64_read(&dev->recoveries);
+	rec->flags = V4L2_CX88SDR_RECOVERY_STOPPED;
+
+	spin_lock_irqsave(&dev->fh_lock, flags);
+	list_for_each_entry(fh, &dev->fh_list, list) {
+		if (seq < fh->start)
+			continue;
+		rec->offset = seq - fh->start;
+		v4l2_event_queue_fh(&fh->fh, &ev);
+	}
+	spin_unlock_irqrestore(&dev->fh_lock, flags);
+}
+
+/* Called from the RISC IRQ, moves to the next scanned input once the dwell is over */
+void cx88sdr_scan_step(struct cx88sdr_dev *dev, u64 head)
+{
+	unsigned long flags;
+	u32 input;
+	u64 tick;
+
+	/* The IRQ is a little late at times, count in whole IRQ periods */
+	tick = (head + CX88SDR_IRQ_PAGES / 2) & ~(u64)(CX88SDR_IRQ_PAGES - 1);
+
+	/* The Input controls change the mask and the input under the same lock */
+	spin_lock_irqsave(&dev->seg_lock, flags);
+	if (!dev->scan_mask || tick < dev->scan_next)
+		goto unlock;
+	dev->scan_next = tick + READ_ONCE(dev->scan_dwell);
+
+	input = dev->input;
+	do {
+		input = (input + 1) % CX88SDR_INPUTS;
+	} while (!(dev->scan_mask & BIT(input)));
+
+	if (input != dev->input) {
+		dev->input = input;
+		cx88sdr_reconfig(dev, false);
+	}
+unlock:
+	spin_unlock_irqrestore(&dev->seg_lock, flags);
+}
+
 static int cx88sdr_s_ctrl(struct v4l2_ctrl *ctrl)
 {
 	struct cx88sdr_dev *dev = container_of(ctrl->handler,
 					       struct cx88sdr_dev, ctrl_handler);
+	unsigned long flags;
 
 	switch (ctrl->id) {
 	case V4L2_CID_GAIN:
@@ -485,8 +1235,54 @@ static int cx88sdr_s_ctrl(struct v4l2_ctrl *ctrl)
 		cx88sdr_gain_set(dev);
 		break;
 	case V4L2_CID_CX88SDR_INPUT:
-		dev->input = ctrl->val;
-		cx88sdr_input_set(dev);
+		/* While scanning the choice waits until the scan stops */
+		spin_lock_irqsave(&dev->seg_lock, flags);
+		dev->input_sel = ctrl->val;
+		if (!dev->scan_mask && dev->input != dev->input_sel) {
+			dev->input = dev->input_sel;
+			cx88sdr_reconfig(dev, false);
+		}
+		spin_unlock_irqrestore(&dev->seg_lock, flags);
+		break;
+	case V4L2_CID_CX88SDR_SCAN_INPUTS:
+		spin_lock_irqsave(&dev->seg_lock, flags);
+		dev->scan_next = 0;
+		dev->scan_mask = ctrl->val;
+		if (!dev->scan_mask && dev->input != dev->input_sel) {
+			dev->input = dev->input_sel;
+			cx88sdr_reconfig(dev, false);
+		}
+		spin_unlock_irqrestore(&dev->seg_lock, flags);
+		break;
+	case V4L2_CID_CX88SDR_SCAN_DWELL:
+		WRITE_ONCE(dev->scan_dwell, ctrl->val);
+		break;
+	case V4L2_CID_CX88SDR_START:
+		dev->start_oldest = ctrl->val;
+		break;
+	default:
+		return -EINVAL;
+	}
+	return 0;
+}
+
+static int cx88sdr_g_volatile_ctrl(struct v4l2_ctrl *ctrl)
+{
+	struct cx88sdr_dev *dev = container_of(ctrl->handler,
+					       struct cx88sdr_dev, ctrl_handler);
+
+	switch (ctrl->id) {
+	case V4L2_CID_CX88SDR_OVERFLOWS:
+		*ctrl->p_new.p_s64 = atomic64_read(&dev->overflows);
+		break;
+	case V4L2_CID_CX88SDR_OVERRUNS:
+		*ctrl->p_new.p_s64 = atomic64_read(&dev->overruns);
+		break;
+	case V4L2_CID_CX88SDR_ERRORS:
+		*ctrl->p_new.p_s64 = atomic64_read(&dev->errors);
+		break;
+	case V4L2_CID_CX88SDR_RECOVERIES:
+		*ctrl->p_new.p_s64 = atomic64_read(&dev->recoveries);
 		break;
 	default:
 		return -EINVAL;
@@ -496,6 +1292,7 @@ static int cx88sdr_s_ctrl(struct v4l2_ctrl *ctrl)
 
 const struct v4l2_ctrl_ops cx88sdr_ctrl_ops = {
 	.s_ctrl = cx88sdr_s_ctrl,
+	.g_volatile_ctrl = cx88sdr_g_volatile_ctrl,
 };
 
 static const char * const cx88sdr_ctrl_input_menu_strings[] = {
@@ -516,3 +1313,170 @@ const struct v4l2_ctrl_config cx88sdr_ctrl_input = {
 	.def	= CX88SDR_INPUT_00,
 	.qmenu	= cx88sdr_ctrl_input_menu_strings,
 };
+
+static const char * const cx88sdr_ctrl_start_menu_strings[] = {
+	"Live Edge",
+	"Oldest Data",
+	NULL,
+};
+
+const struct v4l2_ctrl_config cx88sdr_ctrl_start = {
+	.ops	= &cx88sdr_ctrl_ops,
+	.id	= V4L2_CID_CX88SDR_START,
+	.name	= "Start Position",
+	.type	= V4L2_CTRL_TYPE_MENU,
+	.min	= 0,
+	.max	= 1,
+	.def	= 0,
+	.qmenu	= cx88sdr_ctrl_start_menu_strings,
+};
+
+const struct v4l2_ctrl_config cx88sdr_ctrl_scan_inputs = {
+	.ops	= &cx88sdr_ctrl_ops,
+	.id	= V4L2_CID_CX88SDR_SCAN_INPUTS,
+	.name	= "Scan Inputs",
+	.type	= V4L2_CTRL_TYPE_BITMASK,
+	.min	= 0,
+	.max	= BIT(CX88SDR_INPUTS) - 1,
+	.def	= 0,
+};
+
+const struct v4l2_ctrl_config cx88sdr_ctrl_scan_dwell = {
+	.ops	= &cx88sdr_ctrl_ops,
+	.id	= V4L2_CID_CX88SDR_SCAN_DWELL,
+	.name	= "Scan Dwell (pages)",
+	.type	= V4L2_CTRL_TYPE_INTEGER,
+	.min	= CX88SDR_IRQ_PAGES,
+	.max	= VBI_DMA_PAGES,
+	.step	= CX88SDR_IRQ_PAGES,
+	.def	= 16 * CX88SDR_IRQ_PAGES,
+};
+
+const struct v4l2_ctrl_config cx88sdr_ctrl_overflows = {
+	.ops	= &cx88sdr_ctrl_ops,
+	.id	= V4L2_CID_CX88SDR_OVERFLOWS,
+	.name	= "FIFO Overflows",
+	.type	= V4L2_CTRL_TYPE_INTEGER64,
+	.min	= 0,
+	.max	= S64_MAX,
+	.step	= 1,
+	.def	= 0,
+	.flags	= (V4L2_CTRL_FLAG_READ_ONLY | V4L2_CTRL_FLAG_VOLATILE),
+};
+
+const struct v4l2_ctrl_config cx88sdr_ctrl_overruns = {
+	.ops	= &cx88sdr_ctrl_ops,
+	.id	= V4L2_CID_CX88SDR_OVERRUNS,
+	.name	= "Reader Overruns",
+	.type	= V4L2_CTRL_TYPE_INTEGER64,
+	.min	= 0,
+	.max	= S64_MAX,
+	.step	= 1,
+	.def	= 0,
+	.flags	= (V4L2_CTRL_FLAG_READ_ONLY | V4L2_CTRL_FLAG_VOLATILE),
+};
+
+const struct v4l2_ctrl_config cx88sdr_ctrl_errors = {
+	.ops	= &cx88sdr_ctrl_ops,
+	.id	= V4L2_CID_CX88SDR_ERRORS,
+	.name	= "RISC/PCI Errors",
+	.type	= V4L2_CTRL_TYPE_INTEGER64,
+	.min	= 0,
+	.max	= S64_MAX,
+	.step	= 1,
+	.def	= 0,
+	.flags	= (V4L2_CTRL_FLAG_READ_ONLY | V4L2_CTRL_FLAG_VOLATILE),
+};
+
+const struct v4l2_ctrl_config cx88sdr_ctrl_recoveries = {
+	.ops	= &cx88sdr_ctrl_ops,
+	.id	= V4L2_CID_CX88SDR_RECOVERIES,
+	.name	= "DMA Recoveries",
+	.type	= V4L2_CTRL_TYPE_INTEGER64,
+	.min	= 0,
+	.max	= S64_MAX,
+	.step	= 1,
+	.def	= 0,
+	.flags	= (V4L2_CTRL_FLAG_READ_ONLY | V4L2_CTRL_FLAG_VOLATILE),
+};
+
+static int cx88sdr_fh_s_ctrl(struct v4l2_ctrl *ctrl)
+{
+	struct cx88sdr_fh *fh = container_of(ctrl->handler,
+					     struct cx88sdr_fh, ctrl_handler);
+
+	switch (ctrl->id) {
+	case V4L2_CID_CX88SDR_MAX_LATENCY:
+		WRITE_ONCE(fh->max_latency, ctrl->val);
+		break;
+	case V4L2_CID_CX88SDR_INPUT_FILTER:
+		WRITE_ONCE(fh->input_filter, ctrl->val);
+		break;
+	default:
+		return -EINVAL;
+	}
+	return 0;
+}
+
+static int cx88sdr_fh_g_volatile_ctrl(struct v4l2_ctrl *ctrl)
+{
+	struct cx88sdr_fh *fh = container_of(ctrl->handler,
+					     struct cx88sdr_fh, ctrl_handler);
+
+	switch (ctrl->id) {
+	case V4L2_CID_CX88SDR_SKIPPED:
+		*ctrl->p_new.p_s64 = fh->skipped;
+		break;
+	default:
+		return -EINVAL;
+	}
+	return 0;
+}
+
+static const struct v4l2_ctrl_ops cx88sdr_fh_ctrl_ops = {
+	.s_ctrl			= cx88sdr_fh_s_ctrl,
+	.g_volatile_ctrl	= cx88sdr_fh_g_volatile_ctrl,
+};
+
+static const struct v4l2_ctrl_config cx88sdr_ctrl_max_latency = {
+	.ops	= &cx88sdr_fh_ctrl_ops,
+	.id	= V4L2_CID_CX88SDR_MAX_LATENCY,
+	.name	= "Max Latency (us)",
+	.type	= V4L2_CTRL_TYPE_INTEGER,
+	.min	= 0,
+	.max	= 5000000,
+	.step	= 1,
+	.def	= 0,
+};
+
+static const struct v4l2_ctrl_config cx88sdr_ctrl_skipped = {
+	.ops	= &cx88sdr_fh_ctrl_ops,
+	.id	= V4L2_CID_CX88SDR_SKIPPED,
+	.name	= "Skipped Bytes",
+	.type	= V4L2_CTRL_TYPE_INTEGER64,
+	.min	= 0,
+	.max	= S64_MAX,
+	.step	= 1,
+	.def	= 0,
+	.flags	= (V4L2_CTRL_FLAG_READ_ONLY | V4L2_CTRL_FLAG_VOLATILE),
+};
+
+static const char * const cx88sdr_ctrl_input_filter_menu_strings[] = {
+	"All Inputs",
+	"Input 1",
+	"Input 2",
+	"Input 3",
+	"Input 4",
+	NULL,
+};
+
+static const struct v4l2_ctrl_config cx88sdr_ctrl_input_filter = {
+	.ops	= &cx88sdr_fh_ctrl_ops,
+	.id	= V4L2_CID_CX88SDR_INPUT_FILTER,
+	.name	= "Input Filter",
+	.type	= V4L2_CTRL_TYPE_MENU,
+	.min	= 0,
+	.max	= CX88SDR_INPUTS,
+	.def	= 0,
+	.qmenu	= cx88sdr_ctrl_input_filter_menu_strings,
+};
@@ -0,0 +1,524 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (c) 2020 Jorge Maidana <jorgem.seq@gmail.com>
+ *
+ * cx88sdr_channelize - polyphase filterbank channelizer
+ *
+ * Splits the real RU8/RU16LE stream of one card into N equally spaced
+ * complex channels covering DC to rate / 2, in one pass. A 2N branch
+ * polyphase filter feeds a 2N point real FFT, whose first N bins are the
+ * channels. Channel k is centered at k * rate / (2N) and comes out at
+ * rate / (2N) complex samples per second, twice that when oversampled.
+ *
+ * Input is cut in batches of FFT blocks. Compute workers take whole batches
+ * and leave them channel-major, writer threads each own a group of channels
+ * and write that group's rows to one FIFO per channel as interleaved complex
+ * float (CF32). A consumer that does not keep up loses whole rows, the
+ * channelizer never blocks on it.
+ *
+ * The compute stage is split by time, not by channel: every FFT block mixes
+ * all 2N branches into all N channels, so a channel group would still need
+ * the whole filter and FFT (or an O(N) DFT per channel) for each block. The
+ * filter keeps no state between blocks besides the shared input history, and
+ * what is per channel, the output rows, FIFO and drop count, stays with the
+ * one writer thread that owns the group.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "fft.h"
+#include "sdr_dev.h"
+
+enum batch_state {
+	BATCH_FREE,
+	BATCH_FILLED,
+	BATCH_BUSY,
+	BATCH_DONE,
+};
+
+struct batch {
+	enum batch_state	state;
+	uint64_t		seq;
+	unsigned int		blocks;
+	unsigned int		writers_left;
+	float			*in;	/* hist + blocks * hop samples */
+	float			*out;	/* [channel][block] interleaved re/im */
+};
+
+struct writer {
+	pthread_t		thread;
+	unsigned int		first;	/* First channel of the group */
+	unsigned int		count;
+	double			cpu;
+};
+
+static struct {
+	unsigned int	channels;	/* N */
+	unsigned int	taps;		/* Taps per branch */
+	unsigned int	batch_blocks;
+	unsigned int	workers;
+	unsigned int	writers;
+	int		oversample;
+	const char	*prefix;
+	uint32_t	pixelformat;
+	uint32_t	rate;
+	double		report;
+} opt = {
+	.channels	= 64,
+	.taps		= 8,
+	.batch_blocks	= 256,
+	.workers	= 2,
+	.writers	= 1,
+	.report		= 5.0,
+};
+
+static unsigned int branches, hop, hist;
+static float *coefs;		/* [tap][branch], branch order reversed */
+static struct batch *batches;
+static unsigned int nbatches;
+static struct writer *writers;
+static int *chan_fd;
+static uint64_t *chan_dropped;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static uint64_t next_fill, next_compute, next_free;
+static int eof;
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int __attribute__((unused)) sig)
+{
+	stop = 1;
+}
+
+/* Blackman windowed sinc, cutoff at half the channel spacing, unity DC gain */
+static int design_filter(void)
+{
+	unsigned int len = opt.taps * branches, i, t, p;
+	double *h, sum = 0.0;
+
+	h = calloc(len, sizeof(*h));
+	coefs = calloc(len, sizeof(*coefs));
+	if (!h || !coefs)
+		return -ENOMEM;
+
+	for (i = 0; i < len; i++) {
+		double x = (i - (len - 1) / 2.0) / branches;
+		double w = 0.42 - 0.5 * cos(2 * M_PI * i / (len - 1)) +
+			   0.08 * cos(4 * M_PI * i / (len - 1));
+
+		h[i] = (x == 0.0 ? 1.0 : sin(M_PI * x) / (M_PI * x)) * w;
+		sum += h[i];
+	}
+
+	/*
+	 * Branch p, tap t is h[t * M + p]. Store it reversed in p so the
+	 * polyphase sums run over ascending input addresses.
+	 */
+	for (t = 0; t < opt.taps; t++)
+		for (p = 0; p < branches; p++)
+			coefs[t * branches + (branches - 1 - p)] = h[t * branches + p] / sum;
+
+	free(h);
+	return 0;
+}
+
+static void compute_batch(struct batch *b, struct rfft *fft, float *acc)
+{
+	unsigned int j, k, t, q, n = opt.channels;
+
+	for (j = 0; j < b->blocks; j++) {
+		/* Newest sample of this block */
+		const float *x = b->in + hist + (size_t)(j + 1) * hop - 1;
+		float sign;
+
+		for (q = 0; q < branches; q++)
+			acc[q] = 0.0f;
+		for (t = 0; t < opt.taps; t++) {
+			const float *c = coefs + t * branches;
+			const float *s = x - (t + 1) * branches + 1;
+
+			for (q = 0; q < branches; q++)
+				acc[q] += c[q] * s[q];
+		}
+
+		rfft_run(fft, acc);
+
+		/* Half-block hops leave odd channels rotated by pi on even blocks */
+		sign = (opt.oversample && !((b->seq * b->blocks + j) & 1)) ? -1.0f : 1.0f;
+		for (k = 0; k < n; k++) {
+			float *o = b->out + ((size_t)k * b->blocks + j) * 2;
+			float s = (k & 1) ? sign : 1.0f;
+
+			o[0] = s * fft->re[k];
+			o[1] = s * fft->im[k];
+		}
+	}
+}
+
+static void *worker_thread(void __attribute__((unused)) *arg)
+{
+	struct rfft fft;
+	float *acc;
+
+	acc = calloc(branches, sizeof(float));
+	if (!acc || rfft_init(&fft, branches)) {
+		fprintf(stderr, "worker: out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	pthread_mutex_lock(&lock);
+	for (;;) {
+		struct batch *b = NULL;
+
+		while (!stop) {
+			b = &batches[next_compute % nbatches];
+			if (next_compute < next_fill && b->state == BATCH_FILLED)
+				break;
+			if (eof && next_compute >= next_fill)
+				break;
+			pthread_cond_wait(&cond, &lock);
+		}
+		if (stop || next_compute >= next_fill)
+			break;
+
+		b->state = BATCH_BUSY;
+		next_compute++;
+		pthread_mutex_unlock(&lock);
+
+		compute_batch(b, &fft, acc);
+
+		pthread_mutex_lock(&lock);
+		b->state = BATCH_DONE;
+		pthread_cond_broadcast(&cond);
+	}
+	pthread_mutex_unlock(&lock);
+
+	rfft_free(&fft);
+	free(acc);
+	return NULL;
+}
+
+static void write_group(struct writer *w, const struct batch *b)
+{
+	size_t row = (size_t)b->blocks * 2 * sizeof(float);
+	unsigned int k;
+
+	for (k = w->first; k < w->first + w->count; k++) {
+		ssize_t ret;
+
+		if (chan_fd[k] < 0)
+			continue;
+		ret = write(chan_fd[k], b->out + (size_t)k * b->blocks * 2, row);
+		/* A full pipe drops the whole row, partial writes are counted too */
+		if (ret < (ssize_t)row)
+			chan_dropped[k] += row - (ret > 0 ? ret : 0);
+	}
+}
+
+static void *writer_thread(void *arg)
+{
+	struct writer *w = arg;
+	uint64_t seq = 0;
+	double cpu = sdr_thread_cpu_time();
+
+	pthread_mutex_lock(&lock);
+	for (;;) {
+		struct batch *b = &batches[seq % nbatches];
+
+		while (!stop && !(b->seq == seq && b->state == BATCH_DONE) &&
+		       !(eof && seq >= next_fill))
+			pthread_cond_wait(&cond, &lock);
+		if (stop || seq >= next_fill)
+			break;
+		pthread_mutex_unlock(&lock);
+
+		write_group(w, b);
+
+		pthread_mutex_lock(&lock);
+		w->cpu += sdr_thread_cpu_time() - cpu;
+		cpu = sdr_thread_cpu_time();
+		if (!--b->writers_left) {
+			b->state = BATCH_FREE;
+			next_free++;
+			pthread_cond_broadcast(&cond);
+		}
+		seq++;
+	}
+	pthread_mutex_unlock(&lock);
+	return NULL;
+}
+
+static void convert(const struct sdr_dev *sdr, const void *src, float *dst, size_t n)
+{
+	const uint8_t *s = src;
+	size_t i;
+
+	/* RU16LE is little-endian whatever the host */
+	if (sdr->pixelformat == V4L2_SDR_FMT_RU16LE) {
+		for (i = 0; i < n; i++)
+			dst[i] = ((float)(s[2 * i] | s[2 * i + 1] << 8) - 32768.0f) *
+				 (1.0f / 32768.0f);
+	} else {
+		for (i = 0; i < n; i++)
+			dst[i] = ((float)s[i] - 128.0f) * (1.0f / 128.0f);
+	}
+}
+
+static int open_outputs(void)
+{
+	unsigned int k;
+
+	chan_fd = calloc(opt.channels, sizeof(*chan_fd));
+	chan_dropped = calloc(opt.channels, sizeof(*chan_dropped));
+	if (!chan_fd || !chan_dropped)
+		return -ENOMEM;
+
+	for (k = 0; k < opt.channels; k++) {
+		char path[256];
+
+		chan_fd[k] = -1;
+		if (!opt.prefix)
+			continue;
+
+		snprintf(path, sizeof(path), "%s.%u", opt.prefix, k);
+		if (mkfifo(path, 0644) && errno != EEXIST) {
+			fprintf(stderr, "%s: %s\n", path, strerror(errno));
+			return -errno;
+		}
+		/* O_RDWR keeps the FIFO writable while no consumer is attached */
+		chan_fd[k] = open(path, O_RDWR | O_NONBLOCK);
+		if (chan_fd[k] < 0) {
+			fprintf(stderr, "%s: %s\n", path, strerror(errno));
+			return -errno;
+		}
+	}
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [options] <device>\n"
+		"  -n <num>     Channels, power of 2 (default %u)\n"
+		"  -t <num>     Filter taps per branch (default %u)\n"
+		"  -o           2x oversampled channels\n"
+		"  -b <num>     FFT blocks per batch (default %u)\n"
+		"  -j <num>     Compute threads (default %u)\n"
+		"  -w <num>     Writer threads, one channel group each (default %u)\n"
+		"  -p <prefix>  Create FIFOs <prefix>.0 .. <prefix>.N-1, CF32\n"
+		"  -f <fmt>     Sample format: ru8, ru16\n"
+		"  -s <rate>    Sample rate, selects the band\n"
+		"  -r <sec>     Report period (default %.1f)\n"
+		"Without -p the channels are computed and discarded (benchmark).\n",
+		prog, opt.channels, opt.taps, opt.batch_blocks, opt.workers,
+		opt.writers, opt.report);
+}
+
+int main(int argc, char **argv)
+{
+	struct sdr_dev sdr;
+	struct sigaction sa;
+	pthread_t *workers;
+	void *raw;
+	float *history;
+	size_t ssz, batch_samples;
+	uint64_t in_samples = 0, last_samples = 0;
+	double t0, last, cpu0, last_cpu;
+	unsigned int i;
+	int c, ret;
+
+	while ((c = getopt(argc, argv, "n:t:ob:j:w:p:f:s:r:h")) != -1) {
+		switch (c) {
+		case 'n':
+			opt.channels = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			opt.taps = strtoul(optarg, NULL, 0);
+			break;
+		case 'o':
+			opt.oversample = 1;
+			break;
+		case 'b':
+			opt.batch_blocks = strtoul(optarg, NULL, 0);
+			break;
+		case 'j':
+			opt.workers = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			opt.writers = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			opt.prefix = optarg;
+			break;
+		case 'f':
+			opt.pixelformat = sdr_dev_parse_format(optarg);
+			if (!opt.pixelformat || sdr_dev_format_is_complex(opt.pixelformat)) {
+				fprintf(stderr, "unsupported format %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 's':
+			opt.rate = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			opt.report = strtod(optarg, NULL);
+			break;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (optind != argc - 1 || opt.channels < 2 ||
+	    (opt.channels & (opt.channels - 1)) || !opt.taps ||
+	    !opt.batch_blocks || !opt.workers || !opt.writers ||
+	    opt.writers > opt.channels || opt.report <= 0.0) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	ret = sdr_dev_open(&sdr, argv[optind], 0);
+	if (ret) {
+		fprintf(stderr, "%s: %s\n", argv[optind], strerror(-ret));
+		return EXIT_FAILURE;
+	}
+	if (opt.pixelformat && (ret = sdr_dev_set_format(&sdr, opt.pixelformat)))
+		fprintf(stderr, "can't set format: %s\n", strerror(-ret));
+	if (opt.rate && (ret = sdr_dev_set_rate(&sdr, opt.rate)))
+		fprintf(stderr, "can't set rate: %s\n", strerror(-ret));
+
+	branches = 2 * opt.channels;
+	hop = opt.oversample ? opt.channels : branches;
+	hist = opt.taps * branches - hop;
+	ssz = sdr_dev_sample_size(sdr.pixelformat);
+	batch_samples = (size_t)opt.batch_blocks * hop;
+
+	if (design_filter() || open_outputs())
+		return EXIT_FAILURE;
+
+	/* Enough batches in flight to keep every stage busy */
+	nbatches = 2 * (opt.workers + 1);
+	batches = calloc(nbatches, sizeof(*batches));
+	raw = malloc(batch_samples * ssz);
+	history = calloc(hist ? hist : 1, sizeof(float));
+	workers = calloc(opt.workers, sizeof(*workers));
+	writers = calloc(opt.writers, sizeof(*writers));
+	if (!batches || !raw || !history || !workers || !writers)
+		return EXIT_FAILURE;
+	for (i = 0; i < nbatches; i++) {
+		batches[i].in = malloc((hist + batch_samples) * sizeof(float));
+		batches[i].out = malloc((size_t)opt.channels * opt.batch_blocks *
+					2 * sizeof(float));
+		batches[i].seq = UINT64_MAX;
+		if (!batches[i].in || !batches[i].out)
+			return EXIT_FAILURE;
+	}
+
+	fprintf(stderr, "%s: %s, %u S/s, %u channels of %.0f Hz at %.0f S/s\n",
+		sdr.path, sdr_dev_format_name(sdr.pixelformat), sdr.rate,
+		opt.channels, (double)sdr.rate / branches,
+		(double)sdr.rate / hop);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	for (i = 0; i < opt.workers; i++)
+		pthread_create(&workers[i], NULL, worker_thread, NULL);
+	for (i = 0; i < opt.writers; i++) {
+		unsigned int per = opt.channels / opt.writers;
+
+		writers[i].first = i * per;
+		writers[i].count = (i == opt.writers - 1) ? opt.channels - i * per : per;
+		pthread_create(&writers[i].thread, NULL, writer_thread, &writers[i]);
+	}
+
+	t0 = last = sdr_time_now();
+	cpu0 = last_cpu = (double)clock() / CLOCKS_PER_SEC;
+
+	while (!stop) {
+		struct batch *b;
+		ssize_t len;
+		double now;
+
+		len = sdr_dev_read_full(&sdr, raw, batch_samples * ssz);
+		if (len < (ssize_t)(batch_samples * ssz))
+			break;
+
+		pthread_mutex_lock(&lock);
+		while (!stop && next_fill - next_free >= nbatches)
+			pthread_cond_wait(&cond, &lock);
+		b = &batches[next_fill % nbatches];
+		pthread_mutex_unlock(&lock);
+		if (stop)
+			break;
+
+		memcpy(b->in, history, hist * sizeof(float));
+		convert(&sdr, raw, b->in + hist, batch_samples);
+		memcpy(history, b->in + batch_samples, hist * sizeof(float));
+
+		pthread_mutex_lock(&lock);
+		b->seq = next_fill;
+		b->blocks = opt.batch_blocks;
+		b->writers_left = opt.writers;
+		b->state = BATCH_FILLED;
+		next_fill++;
+		pthread_cond_broadcast(&cond);
+		pthread_mutex_unlock(&lock);
+
+		in_samples += batch_samples;
+		now = sdr_time_now();
+		if (now - last >= opt.report) {
+			double cpu = (double)clock() / CLOCKS_PER_SEC;
+			double msps = (in_samples - last_samples) / (now - last) / 1e6;
+			double cores = (cpu - last_cpu) / (now - last);
+			uint64_t dropped = 0;
+
+			for (i = 0; i < opt.channels; i++)
+				dropped += chan_dropped[i];
+			fprintf(stderr, "%.2f MS/s in, %.2f cores, %.2f MS/s and %.1f channels per core, %llu bytes dropped\n",
+				msps, cores, msps / cores, opt.channels * msps * 1e6 / sdr.rate / cores,
+				(unsigned long long)dropped);
+			last = now;
+			last_cpu = cpu;
+			last_samples = in_samples;
+		}
+	}
+
+	pthread_mutex_lock(&lock);
+	eof = 1;
+	pthread_cond_broadcast(&cond);
+	pthread_mutex_unlock(&lock);
+	for (i = 0; i < opt.workers; i++)
+		pthread_join(workers[i], NULL);
+	for (i = 0; i < opt.writers; i++)
+		pthread_join(writers[i].thread, NULL);
+
+	if (in_samples) {
+		double secs = sdr_time_now() - t0;
+		double cores = ((double)clock() / CLOCKS_PER_SEC - cpu0) / secs;
+
+		fprintf(stderr, "total: %.2f MS/s in, %.2f cores, %.2f MS/s per core\n",
+			in_samples / secs / 1e6, cores, in_samples / secs / 1e6 / cores);
+	}
+
+	for (i = 0; i < opt.channels; i++)
+		if (chan_fd[i] >= 0)
+			close(chan_fd[i]);
+	sdr_dev_close(&sdr);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,251 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (c) 2020 Jorge Maidana <jorgem.seq@gmail.com>
+ *
+ * cx88sdr_ddccheck - verify and time the driver's CS8/CS16LE output
+ *
+ * Two handles read the same backlog, one in the real format of the card
+ * and one in the matching complex format. The real samples are run through
+ * the reference DDC of cx88_sdr_ddc.h and must equal the driver's output
+ * bit for bit. Both handles start on a page boundary, at most a few pages
+ * apart, so the offset between them is found by search. Read speed and CPU
+ * cost of both formats are reported next to the speed of the reference
+ * DDC on one core.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sdr_dev.h"
+#include "cx88_sdr_ddc.h"
+
+#define PAGE_BYTES	4096
+#define MAX_SHIFT	64	/* Pages between the start of the two handles */
+#define CHUNK		(256 << 10)
+
+static struct {
+	unsigned int	mib;
+} opt = {
+	.mib		= 16,
+};
+
+struct handle {
+	struct sdr_dev	sdr;
+	uint8_t		*buf;
+	size_t		done;
+	double		wall;
+	double		cpu;
+	int		skipped;
+};
+
+static int handle_open(struct handle *h, const char *path, uint32_t pixelformat)
+{
+	int ret;
+
+	ret = sdr_dev_open(&h->sdr, path, 0);
+	if (ret)
+		return ret;
+	if (pixelformat != h->sdr.pixelformat) {
+		ret = sdr_dev_set_format(&h->sdr, pixelformat);
+		if (ret)
+			return ret;
+	}
+	return sdr_dev_subscribe(&h->sdr, V4L2_EVENT_CX88SDR_DISCONTINUITY);
+}
+
+static int handle_read(struct handle *h, size_t total)
+{
+	size_t len = total - h->done < CHUNK ? total - h->done : CHUNK;
+	double t0, c0;
+	ssize_t n;
+
+	t0 = sdr_time_now();
+	c0 = sdr_thread_cpu_time();
+	n = read(h->sdr.fd, h->buf + h->done, len);
+	h->wall += sdr_time_now() - t0;
+	h->cpu += sdr_thread_cpu_time() - c0;
+
+	if (n < 0)
+		return errno == EINTR ? 0 : -errno;
+	if (!n)
+		return -EIO;
+	h->done += n;
+	return 0;
+}
+
+static void handle_events(struct handle *h)
+{
+	struct v4l2_event ev;
+
+	while (!sdr_dev_dqevent(&h->sdr, &ev))
+		if (ev.type == V4L2_EVENT_CX88SDR_DISCONTINUITY)
+			h->skipped = 1;
+}
+
+static void handle_report(const struct handle *h)
+{
+	printf("%-6s %10.1f %12.3f\n", sdr_dev_format_name(h->sdr.pixelformat),
+	       h->done / h->wall / 1e6, h->cpu * 1e9 / h->done);
+}
+
+/* The reference output of the real samples, same length in bytes */
+static double reference(const uint8_t *in, size_t len, int wide, uint8_t *out)
+{
+	static struct ddc d;
+	unsigned int shift = wide ? 2 : 1;
+	double c0 = sdr_thread_cpu_time();
+	size_t pos;
+
+	ddc_reset(&d);
+	for (pos = 0; pos + (1u << shift) <= len; ) {
+		unsigned int pairs = (len - pos) >> shift;
+
+		if (pairs > DDC_BLOCK)
+			pairs = DDC_BLOCK;
+		if (wide) {
+			ddc_load_u16(&d, (const ddc_le16 *)(in + pos), pairs);
+			ddc_filter(&d, pairs);
+			ddc_store_cs16(&d, (ddc_le16 *)(out + pos), pairs);
+		} else {
+			ddc_load_u8(&d, in + pos, pairs);
+			ddc_filter(&d, pairs);
+			ddc_store_cs8(&d, (int8_t *)(out + pos), pairs);
+		}
+		pos += pairs << shift;
+	}
+	return sdr_thread_cpu_time() - c0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [options] <device>\n"
+		"  -m <mib>    Bytes read per handle in MiB (default %u)\n",
+		prog, opt.mib);
+}
+
+int main(int argc, char **argv)
+{
+	struct handle real = { .sdr.fd = -1 }, cplx = { .sdr.fd = -1 };
+	struct sdr_dev ctl;
+	uint8_t *ref = NULL;
+	size_t total, skip, cmp, i;
+	unsigned int shift;
+	int c, ret, wide, rc = EXIT_FAILURE;
+	double cpu;
+
+	while ((c = getopt(argc, argv, "m:h")) != -1) {
+		switch (c) {
+		case 'm':
+			opt.mib = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (optind != argc - 1 || !opt.mib || opt.mib > 32) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	total = (size_t)opt.mib << 20;
+
+	/* Keeps the Start Position setting while the test handles open */
+	ret = sdr_dev_open(&ctl, argv[optind], 0);
+	if (!ret && !ctl.is_v4l2)
+		ret = -ENOTTY;
+	if (!ret)
+		ret = sdr_dev_set_start_oldest(&ctl, 1);
+	if (ret) {
+		fprintf(stderr, "%s: %s\n", argv[optind], strerror(-ret));
+		sdr_dev_close(&ctl);
+		return EXIT_FAILURE;
+	}
+	wide = ctl.pixelformat == V4L2_SDR_FMT_RU16LE;
+
+	ret = handle_open(&real, argv[optind], ctl.pixelformat);
+	if (!ret)
+		ret = handle_open(&cplx, argv[optind],
+				  wide ? V4L2_SDR_FMT_CS16LE : V4L2_SDR_FMT_CS8);
+	sdr_dev_set_start_oldest(&ctl, 0);
+	if (ret) {
+		fprintf(stderr, "%s: %s\n", argv[optind], strerror(-ret));
+		goto out;
+	}
+
+	real.buf = malloc(total);
+	cplx.buf = malloc(total);
+	ref = malloc(total);
+	if (!real.buf || !cplx.buf || !ref)
+		goto out;
+
+	/* In step, so neither falls behind the DMA while the other reads */
+	while (real.done < total || cplx.done < total) {
+		if (real.done < total && (ret = handle_read(&real, total)))
+			break;
+		if (cplx.done < total && (ret = handle_read(&cplx, total)))
+			break;
+	}
+	if (ret) {
+		fprintf(stderr, "read: %s\n", strerror(-ret));
+		goto out;
+	}
+	handle_events(&real);
+	handle_events(&cplx);
+	if (real.skipped || cplx.skipped) {
+		fprintf(stderr, "the driver skipped data, try a smaller -m\n");
+		goto out;
+	}
+
+	printf("%s: %s, %u S/s, %u MiB per handle\n", argv[optind],
+	       sdr_dev_format_name(ctl.pixelformat), ctl.rate, opt.mib);
+	printf("%-6s %10s %12s\n", "format", "MB/s", "CPU ns/B");
+	handle_report(&real);
+	handle_report(&cplx);
+
+	cpu = reference(real.buf, total, wide, ref);
+	printf("reference DDC: %.1f MB/s of real input per core\n", total / cpu / 1e6);
+
+	/*
+	 * Output bytes line up with input bytes. The complex handle was primed
+	 * with ring data the reference never saw, skip its settling time.
+	 */
+	skip = (size_t)(DDC_E_HIST + 1) << (wide ? 2 : 1);
+	for (shift = 0; shift <= MAX_SHIFT; shift++) {
+		size_t off = (size_t)shift * PAGE_BYTES;
+
+		if (off + skip + PAGE_BYTES > total)
+			break;
+		if (!memcmp(ref + off + skip, cplx.buf + skip, PAGE_BYTES))
+			break;
+	}
+	if (shift > MAX_SHIFT || (size_t)shift * PAGE_BYTES + skip + PAGE_BYTES > total) {
+		printf("no match within %u pages\n", MAX_SHIFT);
+		goto out;
+	}
+
+	cmp = total - (size_t)shift * PAGE_BYTES;
+	for (i = skip; i < cmp; i++)
+		if (ref[(size_t)shift * PAGE_BYTES + i] != cplx.buf[i])
+			break;
+	if (i < cmp) {
+		printf("MISMATCH at complex byte %zu (handles %u pages apart)\n", i, shift);
+		goto out;
+	}
+	printf("bit-exact over %zu bytes (handles %u pages apart)\n", cmp - skip, shift);
+	rc = EXIT_SUCCESS;
+
+out:
+	free(ref);
+	free(real.buf);
+	free(cplx.buf);
+	sdr_dev_close(&real.sdr);
+	sdr_dev_close(&cplx.sdr);
+	sdr_dev_close(&ctl);
+	return rc;
+}
@@ -0,0 +1,42 @@
+#!/bin/sh
+# SPDX-License-Identifier: GPL-2.0-or-later
+#
+# cx88sdr_dmacmp.sh - compare the coherent and the streaming DMA ring
+#
+# Reloads the module once per mode, runs cx88sdr_rbench on the same devices
+# with the same options and prints both tables side by side, the numbers to
+# quote for a host. Needs root and idle cards. PARAM=zero_read compares
+# reads with and without the old consumed-marker memset instead.
+#
+# Usage: [PARAM=<bool parameter>] cx88sdr_dmacmp.sh <cx88_sdr.ko> <device> [rbench options] [more devices]
+
+set -e
+
+[ $# -ge 2 ] || { echo "Usage: $0 <cx88_sdr.ko> <device> [rbench options] [more devices]" >&2; exit 1; }
+ko=$1
+dev=$2
+shift 2
+param=${PARAM:-dma_streaming}
+
+dir=$(dirname "$0")
+out=$(mktemp -d)
+trap 'rm -rf "$out"' EXIT
+
+for mode in 0 1; do
+	rmmod cx88_sdr 2>/dev/null || true
+	insmod "$ko" "$param=$mode"
+	# udev creates the node shortly after probe
+	for i in 1 2 3 4 5 6 7 8 9 10; do
+		[ -c "$dev" ] && break
+		sleep 0.5
+	done
+	# One lap of the 64 MiB ring at the slowest rate, 14.3 MB/s, so the
+	# backlog test reads captured pages only
+	sleep 5
+	"$dir/cx88sdr_rbench" "$@" "$dev" > "$out/$mode"
+done
+
+echo "$(uname -srm), $(grep -m1 'model name' /proc/cpuinfo | cut -d: -f2 | sed 's/^ //')"
+[ -d /sys/kernel/iommu_groups/0 ] && echo "IOMMU enabled" || echo "no IOMMU"
+printf '%-40s | %s\n' "$param=0" "$param=1"
+paste -d '|' "$out/0" "$out/1" | awk -F'|' '{ printf "%-40s | %s\n", $1, $2 }'
@@ -0,0 +1,277 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (c) 2020 Jorge Maidana <jorgem.seq@gmail.com>
+ *
+ * cx88sdr_level - signal level monitor and gain control for many cards
+ *
+ * Only the driver's statistics events are consumed, the sample stream is
+ * never read, so watching a rack of cards costs next to nothing. With -a
+ * the Gain control is stepped down while samples clip and up while the
+ * peaks stay low. FIFO overflows counted by the driver in each period are
+ * reported next to the levels.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <math.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sdr_dev.h"
+
+#define GAIN_MAX	31
+
+struct card {
+	struct sdr_dev	sdr;
+	int		gain;
+	uint32_t	input;
+	int64_t		overflows;	/* At the start of the period, -1 if unknown */
+
+	/* Accumulated over one report period */
+	unsigned int	blocks;
+	uint64_t	samples;
+	uint64_t	clipped;
+	uint32_t	min;
+	uint32_t	max;
+	double		mean;
+	double		power;
+};
+
+static struct {
+	double		interval;
+	int		agc;
+	double		clip_ppm;	/* Step down above this */
+	double		low;		/* Step up while peaks stay below, of full scale */
+} opt = {
+	.interval	= 1.0,
+	.clip_ppm	= 100.0,
+	.low		= 0.5,
+};
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int __attribute__((unused)) sig)
+{
+	stop = 1;
+}
+
+static void card_reset(struct card *card)
+{
+	card->blocks = 0;
+	card->samples = 0;
+	card->clipped = 0;
+	card->min = UINT32_MAX;
+	card->max = 0;
+	card->mean = 0.0;
+	card->power = 0.0;
+}
+
+static void card_event(struct card *card, const struct v4l2_event *ev)
+{
+	const struct v4l2_event_cx88sdr_stats *st = (const void *)ev->u.data;
+
+	if (ev->type != V4L2_EVENT_CX88SDR_STATS)
+		return;
+
+	card->blocks++;
+	card->samples += st->samples;
+	card->clipped += st->clipped;
+	if (st->min < card->min)
+		card->min = st->min;
+	if (st->max > card->max)
+		card->max = st->max;
+	card->mean += st->mean / 256.0;
+	card->power += (st->rms / 256.0) * (st->rms / 256.0);
+	card->input = st->input;
+}
+
+static void card_report(struct card *card)
+{
+	double mid = (card->sdr.pixelformat == V4L2_SDR_FMT_RU16LE) ? 32768.0 : 128.0;
+	double ppm, rms, peak;
+	int64_t ovf;
+
+	if (!card->blocks) {
+		printf("%-16s no statistics\n", card->sdr.path);
+		return;
+	}
+
+	ppm = 1e6 * card->clipped / card->samples;
+	rms = sqrt(card->power / card->blocks);
+	peak = fmax(card->max - mid, mid - card->min);
+
+	printf("%-16s in %u  min %5u  max %5u  dc %+8.2f  rms %6.1f dBFS  clip %8.1f ppm  gain %2d",
+	       card->sdr.path, card->input + 1, card->min, card->max,
+	       card->mean / card->blocks, 20.0 * log10(rms / mid + 1e-12), ppm,
+	       card->gain);
+	if (card->overflows >= 0 &&
+	    !sdr_dev_get_ctrl64(&card->sdr, V4L2_CID_CX88SDR_OVERFLOWS, &ovf)) {
+		printf("  ovf %" PRId64, ovf - card->overflows);
+		card->overflows = ovf;
+	}
+	printf("\n");
+
+	if (!opt.agc || card->gain < 0)
+		return;
+
+	if (ppm > opt.clip_ppm && card->gain > 0)
+		card->gain--;
+	else if (!card->clipped && peak < opt.low * mid && card->gain < GAIN_MAX)
+		card->gain++;
+	else
+		return;
+
+	if (sdr_dev_set_gain(&card->sdr, card->gain))
+		fprintf(stderr, "%s: can't set gain\n", card->sdr.path);
+}
+
+static int card_setup(struct card *card, const char *path)
+{
+	int ret;
+
+	ret = sdr_dev_open(&card->sdr, path, O_NONBLOCK);
+	if (!ret && !card->sdr.is_v4l2)
+		ret = -ENOTTY;
+	if (!ret)
+		ret = sdr_dev_subscribe(&card->sdr, V4L2_EVENT_CX88SDR_STATS);
+	if (ret) {
+		fprintf(stderr, "%s: %s\n", path, strerror(-ret));
+		return ret;
+	}
+
+	card->gain = sdr_dev_get_gain(&card->sdr);
+	if (sdr_dev_get_ctrl64(&card->sdr, V4L2_CID_CX88SDR_OVERFLOWS, &card->overflows))
+		card->overflows = -1;
+	card_reset(card);
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [options] [device...]\n"
+		"  -i <sec>    Report period (default %.1f)\n"
+		"  -a          Adjust the Gain control\n"
+		"  -c <ppm>    Gain down above this clip rate (default %.0f)\n"
+		"  -l <frac>   Gain up while peaks stay below this part of full scale (default %.2f)\n"
+		"Without devices, all /dev/swradioN nodes are used.\n",
+		prog, opt.interval, opt.clip_ppm, opt.low);
+}
+
+int main(int argc, char **argv)
+{
+	struct pollfd pfd[SDR_MAX_DEVICES];
+	struct card *cards;
+	const char *paths[SDR_MAX_DEVICES];
+	unsigned int ncards = 0, i;
+	struct sigaction sa;
+	double next;
+	int c, ret = EXIT_SUCCESS;
+
+	while ((c = getopt(argc, argv, "i:ac:l:h")) != -1) {
+		switch (c) {
+		case 'i':
+			opt.interval = strtod(optarg, NULL);
+			break;
+		case 'a':
+			opt.agc = 1;
+			break;
+		case 'c':
+			opt.clip_ppm = strtod(optarg, NULL);
+			break;
+		case 'l':
+			opt.low = strtod(optarg, NULL);
+			break;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (opt.interval <= 0.0 || opt.clip_ppm < 0.0 || opt.low <= 0.0) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if (optind < argc) {
+		for (i = optind; i < (unsigned int)argc && ncards < SDR_MAX_DEVICES; i++)
+			paths[ncards++] = argv[i];
+	} else {
+		for (i = 0; i < SDR_MAX_DEVICES; i++) {
+			char path[32];
+
+			snprintf(path, sizeof(path), "/dev/swradio%u", i);
+			if (access(path, R_OK))
+				continue;
+			paths[ncards++] = strdup(path);
+		}
+	}
+	if (!ncards) {
+		fprintf(stderr, "no devices\n");
+		return EXIT_FAILURE;
+	}
+
+	cards = calloc(ncards, sizeof(*cards));
+	if (!cards)
+		return EXIT_FAILURE;
+
+	for (i = 0; i < ncards; i++) {
+		cards[i].sdr.fd = -1;
+		if (card_setup(&cards[i], paths[i])) {
+			ret = EXIT_FAILURE;
+			goto out;
+		}
+		pfd[i].fd = cards[i].sdr.fd;
+		pfd[i].events = POLLPRI;
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	next = sdr_time_now() + opt.interval;
+	while (!stop) {
+		double now = sdr_time_now();
+		struct v4l2_event ev;
+
+		if (now >= next) {
+			for (i = 0; i < ncards; i++) {
+				card_report(&cards[i]);
+				card_reset(&cards[i]);
+			}
+			if (ncards > 1)
+				printf("\n");
+			fflush(stdout);
+			next += opt.interval;
+			continue;
+		}
+
+		if (poll(pfd, ncards, (next - now) * 1000 + 1) < 0) {
+			if (errno == EINTR)
+				continue;
+			ret = EXIT_FAILURE;
+			break;
+		}
+
+		for (i = 0; i < ncards; i++) {
+			if (!(pfd[i].revents & POLLPRI))
+				continue;
+			while (!sdr_dev_dqevent(&cards[i].sdr, &ev))
+				card_event(&cards[i], &ev);
+		}
+	}
+
+out:
+	for (i = 0; i < ncards; i++)
+		sdr_dev_close(&cards[i].sdr);
+	free(cards);
+	return ret;
+}
@@ -0,0 +1,591 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (c) 2020 Jorge Maidana <jorgem.seq@gmail.com>
+ *
+ * cx88sdr_rbench - measure the cost of read() on /dev/swradioN
+ *
+ * Backlog test: a handle opened with Start Position = Oldest Data finds most
+ * of the ring already filled, so reading it back runs at the speed of the
+ * driver's copy path instead of the ADC rate. This is what differs between
+ * the coherent and the streaming (dma_streaming=1) ring.
+ *
+ * Live test: read at the ADC rate for a while and report the CPU time spent
+ * per second of samples, the cost of just keeping up with one card.
+ *
+ * With several devices both tests run on all cards at once, one thread per
+ * card, and report the aggregate rate, the CPU cost and the reader overruns
+ * the driver counted meanwhile.
+ *
+ * On NUMA machines readers can be pinned to the card's node or away from it,
+ * and the share of ring reads that cross nodes is reported from where the
+ * driver placed the ring pages.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#include "sdr_dev.h"
+
+#define MAX_SIZES	16
+#define MAX_NODES	64
+
+enum { PIN_NONE, PIN_LOCAL, PIN_REMOTE };
+
+static struct {
+	unsigned int	sizes[MAX_SIZES];	/* Read sizes in KiB */
+	unsigned int	nsizes;
+	unsigned int	backlog_mib;
+	unsigned int	rounds;
+	double		live;
+	int		pin;
+} opt = {
+	.sizes		= { 4, 16, 64, 256, 1024 },
+	.nsizes		= 5,
+	.backlog_mib	= 48,
+	.rounds		= 3,
+	.live		= 5.0,
+};
+
+static double cpu_time(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec * 1e-6 +
+	       ru.ru_stime.tv_sec + ru.ru_stime.tv_usec * 1e-6;
+}
+
+/* A bool parameter of the loaded module, -1 if unknown */
+static int module_flag(const char *name)
+{
+	char path[128];
+	FILE *f;
+	int c;
+
+	snprintf(path, sizeof(path), "/sys/module/cx88_sdr/parameters/%s", name);
+	f = fopen(path, "r");
+	if (!f)
+		return -1;
+	c = fgetc(f);
+	fclose(f);
+	return c == 'Y' || c == '1';
+}
+
+static const char *dma_mode(void)
+{
+	switch (module_flag("dma_streaming")) {
+	case 0:
+		return "coherent";
+	case 1:
+		return "streaming";
+	default:
+		return "unknown";
+	}
+}
+
+/* The debug memset of copied bytes skews every number, say so */
+static const char *read_mode(const struct sdr_dev *sdr)
+{
+	return sdr->is_v4l2 && module_flag("zero_read") == 1 ? ", zeroed after read" : "";
+}
+
+/* Ring placement of a card, from the driver's sysfs attributes */
+struct numa_info {
+	int		node;			/* -1 when unknown */
+	unsigned int	pages[MAX_NODES];	/* Ring pages per node */
+	unsigned int	total;
+};
+
+/* Attribute of the card's PCI device, relative to it */
+static FILE *card_attr(const char *path, const char *attr)
+{
+	char name[256];
+	struct stat st;
+
+	if (stat(path, &st) || !S_ISCHR(st.st_mode))
+		return NULL;
+	snprintf(name, sizeof(name), "/sys/dev/char/%u:%u/device/%s",
+		 major(st.st_rdev), minor(st.st_rdev), attr);
+	return fopen(name, "r");
+}
+
+static void numa_query(const char *path, struct numa_info *ni)
+{
+	FILE *f;
+	int nid;
+	unsigned int cnt;
+
+	memset(ni, 0, sizeof(*ni));
+	ni->node = -1;
+
+	f = card_attr(path, "numa_node");
+	if (!f)
+		return;
+	if (fscanf(f, "%d", &ni->node) != 1)
+		ni->node = -1;
+	fclose(f);
+
+	f = card_attr(path, "cx88sdr/ring_nodes");
+	if (!f)
+		return;
+	/* "N0=16384 N1=0 unknown=0", unknown pages are never counted local */
+	while (fscanf(f, " N%d=%u", &nid, &cnt) == 2) {
+		if (nid >= 0 && nid < MAX_NODES)
+			ni->pages[nid] = cnt;
+		ni->total += cnt;
+	}
+	if (fscanf(f, " unknown=%u", &cnt) == 1)
+		ni->total += cnt;
+	fclose(f);
+}
+
+static int node_cpus(int node, cpu_set_t *set)
+{
+	char name[64];
+	unsigned int a, b;
+	FILE *f;
+	int n = 0;
+
+	CPU_ZERO(set);
+	snprintf(name, sizeof(name), "/sys/devices/system/node/node%d/cpulist", node);
+	f = fopen(name, "r");
+	if (!f)
+		return 0;
+	/* "0-7,16-23" */
+	while (fscanf(f, "%u", &a) == 1) {
+		b = a;
+		if (fscanf(f, "-%u", &b) != 1)
+			b = a;
+		for (; a <= b && a < CPU_SETSIZE; a++, n++)
+			CPU_SET(a, set);
+		if (fgetc(f) != ',')
+			break;
+	}
+	fclose(f);
+	return n;
+}
+
+static int cpu_node(int cpu)
+{
+	cpu_set_t set;
+	int node;
+
+	for (node = 0; node < MAX_NODES; node++)
+		if (node_cpus(node, &set) && cpu >= 0 && cpu < CPU_SETSIZE &&
+		    CPU_ISSET(cpu, &set))
+			return node;
+	return -1;
+}
+
+/* Pin the calling thread to the card's node or to every other node */
+static void numa_pin(const struct numa_info *ni)
+{
+	cpu_set_t set, local;
+	int cpu;
+
+	if (opt.pin == PIN_NONE || ni->node < 0 || !node_cpus(ni->node, &local))
+		return;
+
+	if (opt.pin == PIN_LOCAL) {
+		set = local;
+	} else {
+		if (sched_getaffinity(0, sizeof(set), &set))
+			return;
+		for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+			if (CPU_ISSET(cpu, &local))
+				CPU_CLR(cpu, &set);
+		if (!CPU_COUNT(&set))
+			return;
+	}
+	sched_setaffinity(0, sizeof(set), &set);
+}
+
+/* Share of the ring that is not on the reader's node, -1 if unknown */
+static double numa_remote(const struct numa_info *ni, int reader)
+{
+	if (!ni->total || reader < 0 || reader >= MAX_NODES)
+		return -1.0;
+	return 1.0 - (double)ni->pages[reader] / ni->total;
+}
+
+static void numa_print(const struct numa_info *ni, int reader, double rate)
+{
+	double remote = numa_remote(ni, reader);
+
+	if (ni->node < 0)
+		return;
+	printf("  card node %d, reader node %d", ni->node, reader);
+	if (remote >= 0.0)
+		printf(", %.0f %% of ring reads remote, est. %.1f MB/s cross-node",
+		       100.0 * remote, remote * rate);
+	printf("\n");
+}
+
+static int read_span(const char *path, void *buf, size_t chunk, size_t total,
+		     double *wall, double *cpu)
+{
+	struct sdr_dev sdr;
+	size_t done = 0;
+	double t0, c0;
+	int ret;
+
+	ret = sdr_dev_open(&sdr, path, 0);
+	if (ret)
+		return ret;
+
+	t0 = sdr_time_now();
+	c0 = cpu_time();
+	while (done < total) {
+		size_t len = total - done < chunk ? total - done : chunk;
+		ssize_t n = read(sdr.fd, buf, len);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		done += n;
+	}
+	*wall = sdr_time_now() - t0;
+	*cpu = cpu_time() - c0;
+	sdr_dev_close(&sdr);
+	return done == total ? 0 : -EIO;
+}
+
+static int run_backlog(const char *path, struct sdr_dev *ctl, void *buf,
+		       const struct numa_info *ni)
+{
+	size_t total = (size_t)opt.backlog_mib << 20;
+	double top = 0.0;
+	unsigned int i, r;
+
+	if (ctl->is_v4l2 && sdr_dev_set_start_oldest(ctl, 1)) {
+		fprintf(stderr, "%s: no Start Position control\n", path);
+		return -1;
+	}
+
+	printf("backlog, %u MiB per round, best of %u\n", opt.backlog_mib, opt.rounds);
+	printf("%10s %10s %12s\n", "read KiB", "MB/s", "CPU ns/B");
+	for (i = 0; i < opt.nsizes; i++) {
+		double best = 0.0, best_cpu = 0.0;
+
+		for (r = 0; r < opt.rounds; r++) {
+			double wall, cpu;
+
+			if (read_span(path, buf, (size_t)opt.sizes[i] << 10,
+				      total, &wall, &cpu)) {
+				fprintf(stderr, "%s: short read\n", path);
+				return -1;
+			}
+			if (total / wall > best) {
+				best = total / wall;
+				best_cpu = cpu;
+			}
+		}
+		printf("%10u %10.1f %12.3f\n", opt.sizes[i], best / 1e6,
+		       best_cpu * 1e9 / total);
+		if (best > top)
+			top = best;
+	}
+	numa_print(ni, cpu_node(sched_getcpu()), top / 1e6);
+
+	if (ctl->is_v4l2)
+		sdr_dev_set_start_oldest(ctl, 0);
+	return 0;
+}
+
+static int run_live(const char *path, void *buf, const struct numa_info *ni)
+{
+	size_t chunk = (size_t)opt.sizes[opt.nsizes - 1] << 10;
+	struct sdr_dev sdr;
+	double t0, c0, wall, cpu;
+	size_t done = 0;
+	int ret;
+
+	ret = sdr_dev_open(&sdr, path, 0);
+	if (ret)
+		return ret;
+
+	t0 = sdr_time_now();
+	c0 = cpu_time();
+	while (sdr_time_now() - t0 < opt.live) {
+		ssize_t n = read(sdr.fd, buf, chunk);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		done += n;
+	}
+	wall = sdr_time_now() - t0;
+	cpu = cpu_time() - c0;
+	sdr_dev_close(&sdr);
+
+	printf("live, %.1f s: %.1f MB/s, CPU %.2f %%\n", wall, done / wall / 1e6,
+	       100.0 * cpu / wall);
+	numa_print(ni, cpu_node(sched_getcpu()), done / wall / 1e6);
+	return 0;
+}
+
+struct card {
+	const char	*path;
+	struct sdr_dev	ctl;
+	pthread_t	thread;
+	void		*buf;
+	size_t		chunk;
+	size_t		total;		/* Backlog bytes, 0 for the live test */
+	size_t		done;
+	int64_t		overruns;
+	struct numa_info numa;
+	int		reader_node;
+	int		ret;
+};
+
+static void *card_thread(void *arg)
+{
+	struct card *card = arg;
+	struct sdr_dev sdr;
+	double t0;
+
+	card->done = 0;
+	numa_pin(&card->numa);
+	card->ret = sdr_dev_open(&sdr, card->path, 0);
+	if (card->ret)
+		return NULL;
+
+	t0 = sdr_time_now();
+	for (;;) {
+		size_t len = card->chunk;
+		ssize_t n;
+
+		if (card->total) {
+			if (card->done >= card->total)
+				break;
+			if (card->total - card->done < len)
+				len = card->total - card->done;
+		} else if (sdr_time_now() - t0 >= opt.live) {
+			break;
+		}
+
+		n = read(sdr.fd, card->buf, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			card->ret = -EIO;
+			break;
+		}
+		card->done += n;
+	}
+	card->reader_node = cpu_node(sched_getcpu());
+	sdr_dev_close(&sdr);
+	return NULL;
+}
+
+static int run_cards(struct card *cards, unsigned int ncards, int backlog)
+{
+	double t0, c0, wall, cpu;
+	size_t total = 0;
+	unsigned int i;
+	int64_t ovr;
+	int ret = 0;
+
+	for (i = 0; i < ncards; i++) {
+		cards[i].total = backlog ? (size_t)opt.backlog_mib << 20 : 0;
+		if (backlog && cards[i].ctl.is_v4l2 &&
+		    sdr_dev_set_start_oldest(&cards[i].ctl, 1)) {
+			fprintf(stderr, "%s: no Start Position control\n", cards[i].path);
+			return -1;
+		}
+		if (sdr_dev_get_ctrl64(&cards[i].ctl, V4L2_CID_CX88SDR_OVERRUNS,
+				       &cards[i].overruns))
+			cards[i].overruns = -1;
+	}
+
+	t0 = sdr_time_now();
+	c0 = cpu_time();
+	for (i = 0; i < ncards; i++)
+		if (pthread_create(&cards[i].thread, NULL, card_thread, &cards[i]))
+			return -1;
+	for (i = 0; i < ncards; i++)
+		pthread_join(cards[i].thread, NULL);
+	wall = sdr_time_now() - t0;
+	cpu = cpu_time() - c0;
+
+	if (backlog)
+		printf("backlog, %u MiB per card, %u cards at once\n", opt.backlog_mib, ncards);
+	else
+		printf("live, %.1f s, %u cards at once\n", wall, ncards);
+	for (i = 0; i < ncards; i++) {
+		if (backlog && cards[i].ctl.is_v4l2)
+			sdr_dev_set_start_oldest(&cards[i].ctl, 0);
+		if (cards[i].ret) {
+			fprintf(stderr, "%s: %s\n", cards[i].path, strerror(-cards[i].ret));
+			ret = -1;
+		}
+		total += cards[i].done;
+		printf("  %-16s %10.1f MB/s", cards[i].path, cards[i].done / wall / 1e6);
+		if (cards[i].overruns >= 0 &&
+		    !sdr_dev_get_ctrl64(&cards[i].ctl, V4L2_CID_CX88SDR_OVERRUNS, &ovr))
+			printf("  overruns %" PRId64, ovr - cards[i].overruns);
+		printf("\n");
+		numa_print(&cards[i].numa, cards[i].reader_node, cards[i].done / wall / 1e6);
+	}
+
+	printf("  total %.1f MB/s, CPU %.3f ns/B (%.1f %%)\n", total / wall / 1e6,
+	       total ? cpu * 1e9 / total : 0.0, 100.0 * cpu / wall);
+	return ret;
+}
+
+static int run_multi(char **paths, unsigned int ncards, size_t chunk)
+{
+	struct card *cards;
+	unsigned int i;
+	int ret = -1;
+
+	cards = calloc(ncards, sizeof(*cards));
+	if (!cards)
+		return -1;
+	for (i = 0; i < ncards; i++)
+		cards[i].ctl.fd = -1;
+
+	for (i = 0; i < ncards; i++) {
+		cards[i].path = paths[i];
+		cards[i].chunk = chunk;
+		cards[i].buf = malloc(chunk);
+		ret = cards[i].buf ? sdr_dev_open(&cards[i].ctl, paths[i], 0) : -ENOMEM;
+		if (ret) {
+			fprintf(stderr, "%s: %s\n", paths[i], strerror(-ret));
+			goto out;
+		}
+		printf("%s: %s, %u S/s, %s ring%s\n", paths[i],
+		       sdr_dev_format_name(cards[i].ctl.pixelformat), cards[i].ctl.rate,
+		       cards[i].ctl.is_v4l2 ? dma_mode() : "no", read_mode(&cards[i].ctl));
+		numa_query(paths[i], &cards[i].numa);
+	}
+
+	ret = run_cards(cards, ncards, 1);
+	if (!ret && opt.live > 0.0)
+		ret = run_cards(cards, ncards, 0);
+
+out:
+	for (i = 0; i < ncards; i++) {
+		sdr_dev_close(&cards[i].ctl);
+		free(cards[i].buf);
+	}
+	free(cards);
+	return ret;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [options] <device...>\n"
+		"  -b <kib,..> Read sizes in KiB (default 4,16,64,256,1024)\n"
+		"  -m <mib>    Backlog read per round in MiB (default %u)\n"
+		"  -n <num>    Rounds per read size (default %u)\n"
+		"  -t <sec>    Live test duration, 0 skips it (default %.1f)\n"
+		"  -p <where>  Pin readers to the card's NUMA node (local) or off it (remote)\n"
+		"Several devices are tested at once with the largest read size.\n",
+		prog, opt.backlog_mib, opt.rounds, opt.live);
+}
+
+int main(int argc, char **argv)
+{
+	struct numa_info ni;
+	struct sdr_dev ctl;
+	unsigned int max_kib = 0, i;
+	char *tok, *save;
+	void *buf;
+	int c, ret;
+
+	while ((c = getopt(argc, argv, "b:m:n:p:t:h")) != -1) {
+		switch (c) {
+		case 'b':
+			opt.nsizes = 0;
+			for (tok = strtok_r(optarg, ",", &save);
+			     tok && opt.nsizes < MAX_SIZES;
+			     tok = strtok_r(NULL, ",", &save))
+				opt.sizes[opt.nsizes++] = strtoul(tok, NULL, 0);
+			break;
+		case 'm':
+			opt.backlog_mib = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			opt.rounds = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			opt.live = strtod(optarg, NULL);
+			break;
+		case 'p':
+			if (!strcmp(optarg, "local")) {
+				opt.pin = PIN_LOCAL;
+			} else if (!strcmp(optarg, "remote")) {
+				opt.pin = PIN_REMOTE;
+			} else {
+				usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (optind >= argc || argc - optind > SDR_MAX_DEVICES || !opt.nsizes ||
+	    !opt.backlog_mib || !opt.rounds || opt.live < 0.0) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	for (i = 0; i < opt.nsizes; i++) {
+		if (!opt.sizes[i]) {
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+		if (opt.sizes[i] > max_kib)
+			max_kib = opt.sizes[i];
+	}
+
+	if (argc - optind > 1)
+		return run_multi(argv + optind, argc - optind, (size_t)max_kib << 10) ?
+		       EXIT_FAILURE : EXIT_SUCCESS;
+
+	/* Keeps the Start Position setting while test handles come and go */
+	ret = sdr_dev_open(&ctl, argv[optind], 0);
+	if (ret) {
+		fprintf(stderr, "%s: %s\n", argv[optind], strerror(-ret));
+		return EXIT_FAILURE;
+	}
+
+	buf = malloc((size_t)max_kib << 10);
+	if (!buf) {
+		sdr_dev_close(&ctl);
+		return EXIT_FAILURE;
+	}
+
+	printf("%s: %s, %u S/s, %s ring%s\n", argv[optind],
+	       sdr_dev_format_name(ctl.pixelformat), ctl.rate,
+	       ctl.is_v4l2 ? dma_mode() : "no", read_mode(&ctl));
+
+	numa_query(argv[optind], &ni);
+	numa_pin(&ni);
+
+	ret = run_backlog(argv[optind], &ctl, buf, &ni);
+	if (!ret && opt.live > 0.0)
+		ret = run_live(argv[optind], buf, &ni);
+
+	free(buf);
+	sdr_dev_close(&ctl);
+	return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+}
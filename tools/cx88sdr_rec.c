@@ -0,0 +1,755 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (c) 2020 Jorge Maidana <jorgem.seq@gmail.com>
+ *
+ * cx88sdr_rec - lossless compressed recording of /dev/swradioN
+ *
+ * The stream is cut in independent frames that compression threads code
+ * with the delta / frame of reference bit-packer in sdr_pack.c, a writer
+ * thread stores them in order and appends one entry per frame to
+ * <file>.idx. Extraction looks the start time up in the index and only
+ * decodes the frames of the requested window.
+ *
+ * Data the driver skipped (reader overrun, DMA recovery) never enters a
+ * frame: a frame is cut where a discontinuity event says the data resumes
+ * and the next one starts at the new stream offset, so gaps show up in the
+ * index and extraction fills them with mid scale (zero for CS8/CS16LE).
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <math.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sdr_dev.h"
+#include "sdr_pack.h"
+
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "recordings are written in host byte order, little endian only"
+#endif
+
+#define MAX_GAPS	64
+
+enum slot_state {
+	SLOT_FREE,
+	SLOT_FILLED,
+	SLOT_BUSY,
+	SLOT_DONE,
+};
+
+struct slot {
+	enum slot_state		state;
+	uint64_t		seq;
+	struct sdr_rec_frame	hdr;
+	uint8_t			*raw;
+	uint8_t			*comp;
+};
+
+/* A discontinuity, in bytes returned by read() and in stream bytes */
+struct gap {
+	uint64_t	pos;
+	uint64_t	offset;
+};
+
+static struct {
+	const char	*out;
+	const char	*extract;
+	uint32_t	pixelformat;
+	uint32_t	rate;
+	unsigned int	workers;
+	unsigned int	frame_kib;
+	double		duration;
+	double		report;
+	double		begin;
+	double		length;
+} opt = {
+	.workers	= 2,
+	.frame_kib	= 1024,
+	.report		= 5.0,
+};
+
+static struct slot *slots;
+static unsigned int nslots;
+static size_t ssize;		/* Bytes per sample */
+static size_t width;		/* Bytes per packed value, an I or Q part for complex formats */
+static int is_complex;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static uint64_t next_fill, next_compute, next_free;
+static int eof, write_error;
+
+/* Under lock */
+static uint64_t raw_bytes, file_bytes;
+static double worker_cpu;
+
+static struct gap gaps[MAX_GAPS];
+static unsigned int ngaps;
+static uint64_t skipped;
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int __attribute__((unused)) sig)
+{
+	stop = 1;
+}
+
+static int write_full(int fd, const void *buf, size_t len)
+{
+	const uint8_t *p = buf;
+
+	while (len) {
+		ssize_t ret = write(fd, p, len);
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		p += ret;
+		len -= ret;
+	}
+	return 0;
+}
+
+static int read_at(int fd, void *buf, size_t len, uint64_t pos)
+{
+	uint8_t *p = buf;
+
+	while (len) {
+		ssize_t ret = pread(fd, p, len, pos);
+
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return ret < 0 ? -errno : -EIO;
+		p += ret;
+		len -= ret;
+		pos += ret;
+	}
+	return 0;
+}
+
+static void set_format(uint32_t pixelformat)
+{
+	ssize = sdr_dev_sample_size(pixelformat);
+	is_complex = sdr_dev_format_is_complex(pixelformat);
+	width = is_complex ? ssize / 2 : ssize;
+}
+
+/* Signed I/Q to offset binary and back, small values should not wrap */
+static void flip_sign(uint8_t *buf, size_t len)
+{
+	size_t i;
+
+	for (i = width - 1; i < len; i += width)
+		buf[i] ^= 0x80;
+}
+
+static void compress_slot(struct slot *s)
+{
+	struct sdr_rec_frame *hdr = &s->hdr;
+	size_t len;
+
+	hdr->adler = sdr_adler32(s->raw, hdr->raw_len);
+	if (is_complex)
+		flip_sign(s->raw, hdr->raw_len);
+	len = sdr_pack(s->raw, hdr->raw_len / width, width, s->comp);
+	if (len < hdr->raw_len) {
+		hdr->codec = SDR_REC_PACKED;
+		hdr->comp_len = len;
+	} else {
+		hdr->codec = SDR_REC_RAW;
+		hdr->comp_len = hdr->raw_len;
+		if (is_complex)
+			flip_sign(s->raw, hdr->raw_len);
+	}
+}
+
+static void *worker_thread(void __attribute__((unused)) *arg)
+{
+	double cpu = sdr_thread_cpu_time();
+
+	pthread_mutex_lock(&lock);
+	for (;;) {
+		struct slot *s = NULL;
+
+		/* Whatever was filled is still compressed after a signal */
+		for (;;) {
+			s = &slots[next_compute % nslots];
+			if (next_compute < next_fill && s->state == SLOT_FILLED)
+				break;
+			if (eof && next_compute >= next_fill)
+				break;
+			pthread_cond_wait(&cond, &lock);
+		}
+		if (next_compute >= next_fill)
+			break;
+
+		s->state = SLOT_BUSY;
+		next_compute++;
+		pthread_mutex_unlock(&lock);
+
+		compress_slot(s);
+
+		pthread_mutex_lock(&lock);
+		worker_cpu += sdr_thread_cpu_time() - cpu;
+		cpu = sdr_thread_cpu_time();
+		s->state = SLOT_DONE;
+		pthread_cond_broadcast(&cond);
+	}
+	pthread_mutex_unlock(&lock);
+	return NULL;
+}
+
+struct writer {
+	int		fd;
+	int		idx_fd;
+	uint64_t	pos;
+};
+
+static int write_slot(struct writer *w, const struct slot *s)
+{
+	struct sdr_rec_index entry = {
+		.offset		= s->hdr.offset,
+		.file_pos	= w->pos,
+	};
+	const void *payload = s->hdr.codec == SDR_REC_RAW ? s->raw : s->comp;
+	int ret;
+
+	ret = write_full(w->fd, &s->hdr, sizeof(s->hdr));
+	if (!ret)
+		ret = write_full(w->fd, payload, s->hdr.comp_len);
+	if (!ret)
+		ret = write_full(w->idx_fd, &entry, sizeof(entry));
+	w->pos += sizeof(s->hdr) + s->hdr.comp_len;
+	return ret;
+}
+
+static void *writer_thread(void *arg)
+{
+	struct writer *w = arg;
+	uint64_t seq = 0;
+
+	pthread_mutex_lock(&lock);
+	for (;;) {
+		struct slot *s = &slots[seq % nslots];
+		int ret;
+
+		while (!(s->seq == seq && s->state == SLOT_DONE) &&
+		       !(eof && seq >= next_fill))
+			pthread_cond_wait(&cond, &lock);
+		if (seq >= next_fill)
+			break;
+		pthread_mutex_unlock(&lock);
+
+		/* After an error frames are only released */
+		ret = write_error ? 0 : write_slot(w, s);
+
+		pthread_mutex_lock(&lock);
+		if (ret) {
+			fprintf(stderr, "%s: %s\n", opt.out, strerror(-ret));
+			write_error = 1;
+			stop = 1;
+		}
+		raw_bytes += s->hdr.raw_len;
+		file_bytes += sizeof(s->hdr) + s->hdr.comp_len;
+		s->state = SLOT_FREE;
+		next_free++;
+		seq++;
+		pthread_cond_broadcast(&cond);
+	}
+	pthread_mutex_unlock(&lock);
+	return NULL;
+}
+
+/*
+ * Queue discontinuities. The event offset counts skipped bytes as well, the
+ * position in the bytes actually returned by read() is where a frame is cut.
+ */
+static void drain_events(struct sdr_dev *sdr, uint64_t got)
+{
+	struct pollfd pfd = { .fd = sdr->fd, .events = POLLPRI };
+	struct v4l2_event ev;
+
+	while (poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLPRI)) {
+		const struct v4l2_event_cx88sdr_discontinuity *d = (const void *)ev.u.data;
+
+		if (sdr_dev_dqevent(sdr, &ev))
+			break;
+		if (ev.type != V4L2_EVENT_CX88SDR_DISCONTINUITY)
+			continue;
+
+		skipped += d->skipped;
+		if (ngaps == MAX_GAPS) {
+			fprintf(stderr, "too many discontinuities, frame offsets may be off\n");
+			continue;
+		}
+		gaps[ngaps].pos = d->offset - skipped;
+		gaps[ngaps].offset = d->offset;
+		if (gaps[ngaps].pos > got)
+			gaps[ngaps].pos = got;
+		ngaps++;
+	}
+}
+
+static void pop_gap(void)
+{
+	memmove(gaps, gaps + 1, --ngaps * sizeof(*gaps));
+}
+
+static void report(double secs, uint64_t raw, uint64_t file, double cpu, const char *what)
+{
+	fprintf(stderr, "%s%.2f MB/s in, ratio %.3f, %.2f cores, %.1f MB/s per core, %" PRIu64 " bytes skipped\n",
+		what, raw / secs / 1e6, file ? (double)raw / file : 0.0, cpu / secs,
+		cpu > 0.0 ? raw / cpu / 1e6 : 0.0, skipped);
+}
+
+static int record(const char *path)
+{
+	struct sdr_rec_header fh;
+	struct writer w;
+	struct sdr_dev sdr;
+	struct sigaction sa;
+	pthread_t *workers, writer;
+	size_t frame_size, carry_len = 0;
+	uint64_t got = 0, base = 0, offset = 0, last_raw = 0, last_file = 0;
+	uint8_t *carry;
+	double t0, last, last_cpu = 0.0;
+	char idx_path[4096];
+	struct timespec ts;
+	unsigned int i;
+	int ret;
+
+	ret = sdr_dev_open(&sdr, path, 0);
+	if (ret) {
+		fprintf(stderr, "%s: %s\n", path, strerror(-ret));
+		return -1;
+	}
+	if (opt.pixelformat && (ret = sdr_dev_set_format(&sdr, opt.pixelformat)))
+		fprintf(stderr, "can't set format: %s\n", strerror(-ret));
+	if (opt.rate && (ret = sdr_dev_set_rate(&sdr, opt.rate)))
+		fprintf(stderr, "can't set rate: %s\n", strerror(-ret));
+	if (sdr.is_v4l2 && sdr_dev_subscribe(&sdr, V4L2_EVENT_CX88SDR_DISCONTINUITY))
+		fprintf(stderr, "%s: no discontinuity events, gaps are not located\n", path);
+
+	set_format(sdr.pixelformat);
+	frame_size = (size_t)opt.frame_kib << 10;
+
+	snprintf(idx_path, sizeof(idx_path), "%s.idx", opt.out);
+	w.fd = open(opt.out, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	w.idx_fd = open(idx_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (w.fd < 0 || w.idx_fd < 0) {
+		fprintf(stderr, "%s: %s\n", w.fd < 0 ? opt.out : idx_path, strerror(errno));
+		return -1;
+	}
+
+	/* Enough frames in flight to keep every thread busy */
+	nslots = 2 * (opt.workers + 1);
+	slots = calloc(nslots, sizeof(*slots));
+	workers = calloc(opt.workers, sizeof(*workers));
+	carry = malloc(frame_size);
+	if (!slots || !workers || !carry)
+		return -1;
+	for (i = 0; i < nslots; i++) {
+		slots[i].raw = malloc(frame_size);
+		slots[i].comp = malloc(sdr_pack_bound(frame_size / width, width));
+		slots[i].seq = UINT64_MAX;
+		if (!slots[i].raw || !slots[i].comp)
+			return -1;
+	}
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	memset(&fh, 0, sizeof(fh));
+	memcpy(fh.magic, SDR_REC_MAGIC, sizeof(SDR_REC_MAGIC));
+	fh.version = SDR_REC_VERSION;
+	fh.pixelformat = sdr.pixelformat;
+	fh.rate = sdr.rate;
+	fh.frame_size = frame_size;
+	fh.start_ns = ts.tv_sec * 1000000000ull + ts.tv_nsec;
+	if (write_full(w.fd, &fh, sizeof(fh)))
+		return -1;
+	w.pos = sizeof(fh);
+
+	fprintf(stderr, "%s: %s, %u S/s, %zu KiB frames, %u threads\n", sdr.path,
+		sdr_dev_format_name(sdr.pixelformat), sdr.rate, frame_size >> 10,
+		opt.workers);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	for (i = 0; i < opt.workers; i++)
+		pthread_create(&workers[i], NULL, worker_thread, NULL);
+	pthread_create(&writer, NULL, writer_thread, &w);
+
+	t0 = last = sdr_time_now();
+	while (!stop && (opt.duration <= 0.0 || sdr_time_now() - t0 < opt.duration)) {
+		size_t len = carry_len, cut;
+		struct slot *s;
+		ssize_t n;
+		double now;
+
+		pthread_mutex_lock(&lock);
+		while (!stop && next_fill - next_free >= nslots)
+			pthread_cond_wait(&cond, &lock);
+		s = &slots[next_fill % nslots];
+		pthread_mutex_unlock(&lock);
+		if (stop)
+			break;
+
+		memcpy(s->raw, carry, carry_len);
+		n = sdr_dev_read_full(&sdr, s->raw + carry_len, frame_size - carry_len);
+		if (n > 0) {
+			got += n;
+			len += n;
+		}
+		len -= len % ssize;
+		if (!len)
+			break;
+		if (sdr.is_v4l2)
+			drain_events(&sdr, got);
+
+		/* Gaps at or before the frame start only move its stream offset */
+		while (ngaps && gaps[0].pos <= base) {
+			offset = gaps[0].offset + (base - gaps[0].pos);
+			pop_gap();
+		}
+		cut = len;
+		if (ngaps && gaps[0].pos < base + len)
+			cut = gaps[0].pos - base;
+
+		s->hdr.magic = SDR_REC_FRAME_MAGIC;
+		s->hdr.offset = offset;
+		s->hdr.raw_len = cut;
+		s->hdr.reserved = 0;
+		offset += cut;
+		base += cut;
+
+		carry_len = len - cut;
+		memcpy(carry, s->raw + cut, carry_len);
+
+		pthread_mutex_lock(&lock);
+		s->seq = next_fill;
+		s->state = SLOT_FILLED;
+		next_fill++;
+		pthread_cond_broadcast(&cond);
+		pthread_mutex_unlock(&lock);
+
+		if (n <= 0 && !carry_len)
+			break;
+
+		now = sdr_time_now();
+		if (now - last >= opt.report) {
+			uint64_t raw, file;
+			double cpu;
+
+			pthread_mutex_lock(&lock);
+			raw = raw_bytes;
+			file = file_bytes;
+			cpu = worker_cpu;
+			pthread_mutex_unlock(&lock);
+
+			report(now - last, raw - last_raw, file - last_file, cpu - last_cpu, "");
+			last = now;
+			last_raw = raw;
+			last_file = file;
+			last_cpu = cpu;
+		}
+	}
+
+	pthread_mutex_lock(&lock);
+	eof = 1;
+	pthread_cond_broadcast(&cond);
+	pthread_mutex_unlock(&lock);
+	for (i = 0; i < opt.workers; i++)
+		pthread_join(workers[i], NULL);
+	pthread_join(writer, NULL);
+
+	if (raw_bytes)
+		report(sdr_time_now() - t0, raw_bytes, file_bytes, worker_cpu, "total: ");
+
+	close(w.fd);
+	close(w.idx_fd);
+	sdr_dev_close(&sdr);
+	return write_error ? -1 : 0;
+}
+
+static int load_index(int fd, struct sdr_rec_index **idx, size_t *count)
+{
+	struct sdr_rec_frame hdr;
+	char path[4096];
+	size_t n = 0, max = 0;
+	uint64_t pos;
+	off_t size;
+	int ifd;
+
+	snprintf(path, sizeof(path), "%s.idx", opt.extract);
+	ifd = open(path, O_RDONLY);
+	if (ifd >= 0) {
+		size = lseek(ifd, 0, SEEK_END);
+		*count = size / sizeof(**idx);
+		*idx = malloc(*count * sizeof(**idx) + 1);
+		if (!*idx || read_at(ifd, *idx, *count * sizeof(**idx), 0)) {
+			close(ifd);
+			return -EIO;
+		}
+		close(ifd);
+		return 0;
+	}
+
+	/* Without an index, walk the frame headers */
+	fprintf(stderr, "%s: %s, scanning the recording\n", path, strerror(errno));
+	*idx = NULL;
+	for (pos = sizeof(struct sdr_rec_header);
+	     !read_at(fd, &hdr, sizeof(hdr), pos) && hdr.magic == SDR_REC_FRAME_MAGIC;
+	     pos += sizeof(hdr) + hdr.comp_len) {
+		if (n == max) {
+			struct sdr_rec_index *tmp;
+
+			max = max ? 2 * max : 1024;
+			tmp = realloc(*idx, max * sizeof(**idx));
+			if (!tmp)
+				return -ENOMEM;
+			*idx = tmp;
+		}
+		(*idx)[n].offset = hdr.offset;
+		(*idx)[n].file_pos = pos;
+		n++;
+	}
+	*count = n;
+	return 0;
+}
+
+static int write_mid(int fd, uint8_t *buf, size_t size, uint64_t len)
+{
+	size_t i;
+	int ret;
+
+	for (i = 0; i < size; i++)
+		buf[i] = (is_complex || (width == 2 && !(i & 1))) ? 0x00 : 0x80;
+
+	while (len) {
+		size_t n = len < size ? len : size;
+
+		ret = write_full(fd, buf, n);
+		if (ret)
+			return ret;
+		len -= n;
+	}
+	return 0;
+}
+
+static int extract(void)
+{
+	struct sdr_rec_header fh;
+	struct sdr_rec_index *idx;
+	size_t count, lo, hi, i, frames = 0;
+	uint64_t start, end, pos, decoded = 0, filled = 0;
+	uint8_t *raw, *comp;
+	double t0, cpu0;
+	int fd, out, ret = 0;
+
+	fd = open(opt.extract, O_RDONLY);
+	if (fd < 0 || read_at(fd, &fh, sizeof(fh), 0) ||
+	    memcmp(fh.magic, SDR_REC_MAGIC, sizeof(SDR_REC_MAGIC)) ||
+	    fh.version != SDR_REC_VERSION || !fh.rate || !fh.frame_size) {
+		fprintf(stderr, "%s: not a cx88sdr_rec recording\n", opt.extract);
+		return -1;
+	}
+	set_format(fh.pixelformat);
+
+	if (load_index(fd, &idx, &count)) {
+		fprintf(stderr, "%s: can't read the index\n", opt.extract);
+		return -1;
+	}
+
+	out = opt.out ? open(opt.out, O_WRONLY | O_CREAT | O_TRUNC, 0644) : STDOUT_FILENO;
+	raw = malloc(fh.frame_size);
+	comp = malloc(fh.frame_size + SDR_PACK_PAD);
+	if (out < 0 || !raw || !comp) {
+		fprintf(stderr, "%s: %s\n", opt.out, strerror(errno));
+		return -1;
+	}
+
+	start = (uint64_t)llround(opt.begin * fh.rate) * ssize;
+	end = opt.length > 0.0 ? start + (uint64_t)llround(opt.length * fh.rate) * ssize
+			       : UINT64_MAX;
+
+	fprintf(stderr, "%s: %s, %u S/s, %zu frames, recorded %.1f s\n", opt.extract,
+		sdr_dev_format_name(fh.pixelformat), fh.rate, count,
+		count ? (double)(idx[count - 1].offset + fh.frame_size) / ssize / fh.rate : 0.0);
+
+	/* Last frame starting at or before the window */
+	lo = 0;
+	hi = count;
+	while (hi - lo > 1) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (idx[mid].offset <= start)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	t0 = sdr_time_now();
+	cpu0 = sdr_thread_cpu_time();
+	pos = start;
+	for (i = lo; i < count && pos < end; i++) {
+		struct sdr_rec_frame hdr;
+		uint64_t first, last;
+		int bad = 0;
+
+		if (read_at(fd, &hdr, sizeof(hdr), idx[i].file_pos) ||
+		    hdr.magic != SDR_REC_FRAME_MAGIC || hdr.offset != idx[i].offset ||
+		    hdr.raw_len > fh.frame_size || hdr.comp_len > hdr.raw_len ||
+		    read_at(fd, comp, hdr.comp_len, idx[i].file_pos + sizeof(hdr))) {
+			fprintf(stderr, "frame %zu: truncated or damaged\n", i);
+			ret = -1;
+			break;
+		}
+		memset(comp + hdr.comp_len, 0, SDR_PACK_PAD);
+
+		if (hdr.codec == SDR_REC_RAW)
+			memcpy(raw, comp, hdr.raw_len);
+		else if (hdr.codec == SDR_REC_PACKED)
+			bad = sdr_unpack(comp, hdr.comp_len, hdr.raw_len / width, width, raw);
+		else
+			bad = 1;
+		if (!bad && hdr.codec == SDR_REC_PACKED && is_complex)
+			flip_sign(raw, hdr.raw_len);
+		if (bad || sdr_adler32(raw, hdr.raw_len) != hdr.adler) {
+			fprintf(stderr, "frame %zu: checksum mismatch\n", i);
+			ret = -1;
+			break;
+		}
+		frames++;
+		decoded += hdr.raw_len;
+
+		first = hdr.offset;
+		last = hdr.offset + hdr.raw_len;
+		if (last <= pos)
+			continue;
+		if (first > pos) {
+			uint64_t gap = (first < end ? first : end) - pos;
+
+			if (write_mid(out, comp, fh.frame_size, gap))
+				break;
+			filled += gap;
+			pos += gap;
+			if (pos >= end)
+				break;
+		}
+		if (last > end)
+			last = end;
+		if (write_full(out, raw + (pos - first), last - pos)) {
+			fprintf(stderr, "%s: %s\n", opt.out ? opt.out : "stdout", strerror(errno));
+			ret = -1;
+			break;
+		}
+		pos = last;
+	}
+
+	fprintf(stderr, "%zu frames, %.1f MB decoded in %.2f s, %.1f MB/s per core, %" PRIu64 " gap bytes filled\n",
+		frames, decoded / 1e6, sdr_time_now() - t0,
+		decoded / (sdr_thread_cpu_time() - cpu0 + 1e-9) / 1e6, filled);
+
+	if (opt.out)
+		close(out);
+	close(fd);
+	free(idx);
+	free(raw);
+	free(comp);
+	return ret;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [options] -o <file> <device>\n"
+		"       %s -x <file> [-b <sec>] [-l <sec>] [-o <file>]\n"
+		"  -o <file>   Recording, the frame index goes to <file>.idx\n"
+		"  -f <fmt>    Sample format: ru8, ru16, cs8, cs16\n"
+		"  -s <rate>   Sample rate, selects the band\n"
+		"  -j <num>    Compression threads (default %u)\n"
+		"  -F <kib>    Frame size in KiB, 16 to 65536 (default %u)\n"
+		"  -d <sec>    Stop after this long (default: when interrupted)\n"
+		"  -r <sec>    Report period (default %.1f)\n"
+		"  -x <file>   Extract raw samples from a recording, to stdout without -o\n"
+		"  -b <sec>    Extract from this time on (default 0)\n"
+		"  -l <sec>    Extract this long (default: to the end)\n",
+		prog, prog, opt.workers, opt.frame_kib, opt.report);
+}
+
+int main(int argc, char **argv)
+{
+	int c;
+
+	while ((c = getopt(argc, argv, "o:f:s:j:F:d:r:x:b:l:h")) != -1) {
+		switch (c) {
+		case 'o':
+			opt.out = optarg;
+			break;
+		case 'f':
+			opt.pixelformat = sdr_dev_parse_format(optarg);
+			if (!opt.pixelformat) {
+				fprintf(stderr, "unknown format %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 's':
+			opt.rate = strtoul(optarg, NULL, 0);
+			break;
+		case 'j':
+			opt.workers = strtoul(optarg, NULL, 0);
+			break;
+		case 'F':
+			opt.frame_kib = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			opt.duration = strtod(optarg, NULL);
+			break;
+		case 'r':
+			opt.report = strtod(optarg, NULL);
+			break;
+		case 'x':
+			opt.extract = optarg;
+			break;
+		case 'b':
+			opt.begin = strtod(optarg, NULL);
+			break;
+		case 'l':
+			opt.length = strtod(optarg, NULL);
+			break;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (opt.extract) {
+		if (optind != argc || opt.begin < 0.0 || opt.length < 0.0) {
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+		return extract() ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
+
+	if (optind != argc - 1 || !opt.out || !opt.workers || opt.frame_kib < 16 ||
+	    opt.frame_kib > 65536 || opt.report <= 0.0) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	return record(argv[optind]) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
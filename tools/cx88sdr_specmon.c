@@ -0,0 +1,587 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (c) 2020 Jorge Maidana <jorgem.seq@gmail.com>
+ *
+ * cx88sdr_specmon - averaged power spectra from many cards
+ *
+ * One reader thread per card fetches the freshest block of samples at the
+ * requested frame rate and hands it to a small worker pool that runs
+ * windowed real FFTs, averages them exponentially and publishes the result
+ * in a shared memory segment per card (see specmon_shm.h).
+ *
+ * The driver's Max Latency control makes each read start at the live edge,
+ * so only the samples that are analyzed ever cross into user space. Sources
+ * without it (older drivers, FIFOs) are drained continuously instead.
+ * A block the driver skipped data in is not contiguous and is dropped.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <math.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "fft.h"
+#include "sdr_dev.h"
+#include "specmon_shm.h"
+
+#define READ_CHUNK	(256 * 1024)
+#define LIVE_EDGE_USEC	1000
+
+struct card {
+	int			idx;
+	struct sdr_dev		sdr;
+	pthread_t		reader;
+	int			live_edge;
+	int			events;		/* Discontinuities subscribed */
+	uint64_t		got;		/* Bytes returned by read() */
+	uint64_t		skipped;	/* Bytes the driver skipped */
+
+	/* Job handed to the pool, owned by a worker while busy is set */
+	int			busy;
+	uint8_t			*job;
+	size_t			job_len;
+	float			*avg;
+	int			avg_valid;
+
+	struct specmon_shm	*shm;
+	size_t			shm_len;
+	char			shm_name[32];
+
+	/* Statistics, protected by pool_lock */
+	uint64_t		bytes;
+	uint64_t		frames;
+	uint64_t		dropped;
+	uint64_t		cut;
+	double			cpu;
+};
+
+static struct {
+	unsigned int	fft_size;
+	unsigned int	fft_per_frame;
+	double		frame_rate;
+	double		alpha;
+	unsigned int	workers;
+	double		report;
+	uint32_t	pixelformat;
+	uint32_t	rate;
+	int		gain;
+	int		input;
+} opt = {
+	.fft_size	= 1024,
+	.fft_per_frame	= 16,
+	.frame_rate	= 10.0,
+	.alpha		= 0.2,
+	.workers	= 2,
+	.report		= 5.0,
+	.gain		= -1,
+	.input		= -1,
+};
+
+static struct card *cards;
+static unsigned int ncards;
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_cond = PTHREAD_COND_INITIALIZER;
+static struct card **queue;
+static unsigned int queue_head, queue_len;
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int __attribute__((unused)) sig)
+{
+	stop = 1;
+}
+
+static void queue_push(struct card *card)
+{
+	queue[(queue_head + queue_len) % ncards] = card;
+	queue_len++;
+	pthread_cond_signal(&pool_cond);
+}
+
+static struct card *queue_pop(void)
+{
+	struct card *card;
+
+	while (!queue_len && !stop)
+		pthread_cond_wait(&pool_cond, &pool_lock);
+	if (!queue_len)
+		return NULL;
+
+	card = queue[queue_head];
+	queue_head = (queue_head + 1) % ncards;
+	queue_len--;
+	return card;
+}
+
+/*
+ * Account for read() bytes [start, card->got). The event offset counts the
+ * skipped bytes too, true if data resumed inside the span.
+ */
+static int card_cut(struct card *card, uint64_t start)
+{
+	struct pollfd pfd = { .fd = card->sdr.fd, .events = POLLPRI };
+	struct v4l2_event ev;
+	int cut = 0;
+
+	if (!card->events)
+		return 0;
+
+	while (poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLPRI)) {
+		const struct v4l2_event_cx88sdr_discontinuity *d = (const void *)ev.u.data;
+		uint64_t at;
+
+		if (sdr_dev_dqevent(&card->sdr, &ev))
+			break;
+		if (ev.type != V4L2_EVENT_CX88SDR_DISCONTINUITY)
+			continue;
+
+		card->skipped += d->skipped;
+		at = d->offset - card->skipped;
+		if (at > start && at < card->got)
+			cut = 1;
+	}
+	return cut;
+}
+
+static void *reader_thread(void *arg)
+{
+	struct card *card = arg;
+	double period = 1.0 / opt.frame_rate;
+	double next = sdr_time_now() + period;
+	double cpu_last = sdr_thread_cpu_time();
+	uint8_t *chunk;
+
+	chunk = malloc(READ_CHUNK);
+	if (!chunk)
+		return NULL;
+
+	while (!stop) {
+		double now = sdr_time_now(), cpu_now;
+		ssize_t ret;
+		int busy;
+
+		if (now >= next) {
+			next += period;
+			if (next < now)
+				next = now + period;
+
+			pthread_mutex_lock(&pool_lock);
+			busy = card->busy;
+			if (busy)
+				card->dropped++;
+			pthread_mutex_unlock(&pool_lock);
+
+			if (!busy) {
+				ret = sdr_dev_read_full(&card->sdr, card->job, card->job_len);
+				if (ret < (ssize_t)card->job_len)
+					break;
+				card->got += ret;
+
+				pthread_mutex_lock(&pool_lock);
+				card->bytes += ret;
+				if (card_cut(card, card->got - ret)) {
+					card->cut++;
+				} else {
+					card->busy = 1;
+					queue_push(card);
+				}
+				pthread_mutex_unlock(&pool_lock);
+				continue;
+			}
+		}
+
+		if (card->live_edge) {
+			/* The driver skips ahead on the next read */
+			if (next > now)
+				usleep((next - now) * 1e6);
+			ret = 0;
+		} else {
+			/* Keep the device drained so the next job starts at the live edge */
+			ret = read(card->sdr.fd, chunk, READ_CHUNK);
+			if (ret < 0 && errno == EINTR)
+				continue;
+			if (ret <= 0)
+				break;
+			card->got += ret;
+			card_cut(card, card->got - ret);
+		}
+
+		cpu_now = sdr_thread_cpu_time();
+		pthread_mutex_lock(&pool_lock);
+		card->bytes += ret;
+		card->cpu += cpu_now - cpu_last;
+		pthread_mutex_unlock(&pool_lock);
+		cpu_last = cpu_now;
+	}
+
+	if (!stop)
+		fprintf(stderr, "%s: read stopped\n", card->sdr.path);
+	free(chunk);
+	return NULL;
+}
+
+static void convert(const struct card *card, const uint8_t *src,
+		    const float *win, float *dst, unsigned int n)
+{
+	unsigned int i;
+
+	/* RU16LE is little-endian whatever the host */
+	if (card->sdr.pixelformat == V4L2_SDR_FMT_RU16LE) {
+		for (i = 0; i < n; i++)
+			dst[i] = ((float)(src[2 * i] | src[2 * i + 1] << 8) - 32768.0f) *
+				 (1.0f / 32768.0f) * win[i];
+	} else {
+		for (i = 0; i < n; i++)
+			dst[i] = ((float)src[i] - 128.0f) * (1.0f / 128.0f) * win[i];
+	}
+}
+
+static void publish(struct card *card, const float *avg, float norm)
+{
+	struct specmon_shm *shm = card->shm;
+	unsigned int k, bins = opt.fft_size / 2 + 1;
+
+	__atomic_store_n(&shm->seq, shm->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	for (k = 0; k < bins; k++)
+		shm->power_db[k] = 10.0f * log10f(avg[k] * norm + 1e-20f);
+	shm->rate = card->sdr.rate;
+	shm->frames = card->frames;
+	shm->dropped = card->dropped;
+	shm->timestamp = sdr_time_now();
+
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(&shm->seq, shm->seq + 1, __ATOMIC_RELAXED);
+}
+
+static void *worker_thread(void __attribute__((unused)) *arg)
+{
+	unsigned int n = opt.fft_size, bins = n / 2 + 1, i, k;
+	float *win, *buf, *pow, *sum, norm, wsum = 0.0f;
+	struct rfft fft;
+
+	win = calloc(n, sizeof(float));
+	buf = calloc(n, sizeof(float));
+	pow = calloc(bins, sizeof(float));
+	sum = calloc(bins, sizeof(float));
+	if (!win || !buf || !pow || !sum || rfft_init(&fft, n)) {
+		fprintf(stderr, "worker: out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	fft_hann(win, n);
+	for (i = 0; i < n; i++)
+		wsum += win[i];
+	/* A full scale tone reads 0 dBFS */
+	norm = 4.0f / (wsum * wsum);
+
+	for (;;) {
+		struct card *card;
+		size_t ssz;
+		double cpu;
+
+		pthread_mutex_lock(&pool_lock);
+		card = queue_pop();
+		pthread_mutex_unlock(&pool_lock);
+		if (!card)
+			break;
+
+		cpu = sdr_thread_cpu_time();
+		ssz = sdr_dev_sample_size(card->sdr.pixelformat);
+
+		memset(sum, 0, bins * sizeof(float));
+		for (i = 0; i < opt.fft_per_frame; i++) {
+			convert(card, card->job + (size_t)i * n * ssz, win, buf, n);
+			rfft_power(&fft, buf, pow);
+			for (k = 0; k < bins; k++)
+				sum[k] += pow[k];
+		}
+		for (k = 0; k < bins; k++)
+			sum[k] *= 1.0f / opt.fft_per_frame;
+
+		if (!card->avg_valid) {
+			memcpy(card->avg, sum, bins * sizeof(float));
+			card->avg_valid = 1;
+		} else {
+			float a = opt.alpha;
+
+			for (k = 0; k < bins; k++)
+				card->avg[k] += a * (sum[k] - card->avg[k]);
+		}
+
+		pthread_mutex_lock(&pool_lock);
+		card->frames++;
+		publish(card, card->avg, norm);
+		card->cpu += sdr_thread_cpu_time() - cpu;
+		card->busy = 0;
+		pthread_mutex_unlock(&pool_lock);
+	}
+
+	rfft_free(&fft);
+	free(win);
+	free(buf);
+	free(pow);
+	free(sum);
+	return NULL;
+}
+
+static int card_setup(struct card *card, const char *path)
+{
+	size_t bins = opt.fft_size / 2 + 1;
+	int ret, fd;
+
+	ret = sdr_dev_open(&card->sdr, path, 0);
+	if (ret) {
+		fprintf(stderr, "%s: %s\n", path, strerror(-ret));
+		return ret;
+	}
+	if (opt.pixelformat) {
+		ret = sdr_dev_set_format(&card->sdr, opt.pixelformat);
+		if (ret)
+			fprintf(stderr, "%s: can't set format: %s\n", path, strerror(-ret));
+	}
+	if (opt.rate) {
+		ret = sdr_dev_set_rate(&card->sdr, opt.rate);
+		if (ret)
+			fprintf(stderr, "%s: can't set rate: %s\n", path, strerror(-ret));
+	}
+	if (opt.gain >= 0 && sdr_dev_set_gain(&card->sdr, opt.gain))
+		fprintf(stderr, "%s: can't set gain\n", path);
+	if (opt.input >= 0 && sdr_dev_set_input(&card->sdr, opt.input))
+		fprintf(stderr, "%s: can't set input\n", path);
+	card->live_edge = !sdr_dev_set_max_latency(&card->sdr, LIVE_EDGE_USEC);
+	card->events = card->sdr.is_v4l2 &&
+		       !sdr_dev_subscribe(&card->sdr, V4L2_EVENT_CX88SDR_DISCONTINUITY);
+
+	card->job_len = (size_t)opt.fft_size * opt.fft_per_frame *
+			sdr_dev_sample_size(card->sdr.pixelformat);
+	card->job = malloc(card->job_len);
+	card->avg = calloc(bins, sizeof(float));
+	if (!card->job || !card->avg)
+		return -ENOMEM;
+
+	snprintf(card->shm_name, sizeof(card->shm_name), SPECMON_SHM_NAME "%d",
+		 card->idx);
+	card->shm_len = sizeof(*card->shm) + bins * sizeof(float);
+	fd = shm_open(card->shm_name, O_CREAT | O_RDWR, 0644);
+	if (fd < 0)
+		return -errno;
+	if (ftruncate(fd, card->shm_len) < 0) {
+		close(fd);
+		return -errno;
+	}
+	card->shm = mmap(NULL, card->shm_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (card->shm == MAP_FAILED)
+		return -errno;
+
+	memset(card->shm, 0, card->shm_len);
+	card->shm->magic = SPECMON_SHM_MAGIC;
+	card->shm->version = SPECMON_SHM_VERSION;
+	card->shm->bins = bins;
+	card->shm->rate = card->sdr.rate;
+
+	fprintf(stderr, "%s: %s, %u S/s -> %s%s\n", path,
+		sdr_dev_format_name(card->sdr.pixelformat), card->sdr.rate,
+		card->shm_name, card->live_edge ? ", live edge" : "");
+	return 0;
+}
+
+static void card_teardown(struct card *card)
+{
+	if (card->shm && card->shm != MAP_FAILED) {
+		munmap(card->shm, card->shm_len);
+		shm_unlink(card->shm_name);
+	}
+	sdr_dev_close(&card->sdr);
+	free(card->job);
+	free(card->avg);
+}
+
+static void report(double elapsed)
+{
+	double total = 0.0;
+	unsigned int i;
+
+	pthread_mutex_lock(&pool_lock);
+	for (i = 0; i < ncards; i++) {
+		struct card *card = &cards[i];
+		double load = card->cpu / elapsed;
+
+		fprintf(stderr, "[%u] %-16s %7.2f MB/s  %6.2f%% CPU  frames %llu  dropped %llu  cut %llu\n",
+			i, card->sdr.path, card->bytes / elapsed / 1e6, 100.0 * load,
+			(unsigned long long)card->frames,
+			(unsigned long long)card->dropped,
+			(unsigned long long)card->cut);
+		card->shm->cpu_load = load;
+		total += load;
+		card->bytes = 0;
+		card->cpu = 0.0;
+	}
+	pthread_mutex_unlock(&pool_lock);
+	fprintf(stderr, "total %6.2f%% CPU for %u cards\n", 100.0 * total, ncards);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [options] [device...]\n"
+		"  -n <size>   FFT size, power of 2 (default %u)\n"
+		"  -m <num>    FFTs averaged per frame (default %u)\n"
+		"  -r <hz>     Frames per second (default %.1f)\n"
+		"  -a <alpha>  Exponential averaging factor, 0-1 (default %.2f)\n"
+		"  -j <num>    Worker threads (default %u)\n"
+		"  -f <fmt>    Sample format: ru8, ru16\n"
+		"  -s <rate>   Sample rate, selects the band\n"
+		"  -g <gain>   Gain, 0-31\n"
+		"  -i <input>  Input, 0-3\n"
+		"  -p <sec>    CPU report period (default %.1f)\n"
+		"Without devices, all /dev/swradioN nodes are used.\n",
+		prog, opt.fft_size, opt.fft_per_frame, opt.frame_rate,
+		opt.alpha, opt.workers, opt.report);
+}
+
+int main(int argc, char **argv)
+{
+	static const char *paths[SDR_MAX_DEVICES];
+	struct sigaction sa;
+	pthread_t *workers;
+	double last;
+	unsigned int i;
+	int c, ret = EXIT_SUCCESS;
+
+	while ((c = getopt(argc, argv, "n:m:r:a:j:f:s:g:i:p:h")) != -1) {
+		switch (c) {
+		case 'n':
+			opt.fft_size = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			opt.fft_per_frame = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			opt.frame_rate = strtod(optarg, NULL);
+			break;
+		case 'a':
+			opt.alpha = strtod(optarg, NULL);
+			break;
+		case 'j':
+			opt.workers = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			opt.pixelformat = sdr_dev_parse_format(optarg);
+			if (!opt.pixelformat || sdr_dev_format_is_complex(opt.pixelformat)) {
+				fprintf(stderr, "unsupported format %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 's':
+			opt.rate = strtoul(optarg, NULL, 0);
+			break;
+		case 'g':
+			opt.gain = atoi(optarg);
+			break;
+		case 'i':
+			opt.input = atoi(optarg);
+			break;
+		case 'p':
+			opt.report = strtod(optarg, NULL);
+			break;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (opt.fft_size < 4 || (opt.fft_size & (opt.fft_size - 1)) ||
+	    !opt.fft_per_frame || opt.frame_rate <= 0.0 ||
+	    opt.alpha <= 0.0 || opt.alpha > 1.0 || !opt.workers || opt.report <= 0.0) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if (optind < argc) {
+		for (i = optind; i < (unsigned int)argc && ncards < SDR_MAX_DEVICES; i++)
+			paths[ncards++] = argv[i];
+	} else {
+		for (i = 0; i < SDR_MAX_DEVICES; i++) {
+			char path[32];
+
+			snprintf(path, sizeof(path), "/dev/swradio%u", i);
+			if (access(path, R_OK))
+				continue;
+			paths[ncards++] = strdup(path);
+		}
+	}
+	if (!ncards) {
+		fprintf(stderr, "no devices\n");
+		return EXIT_FAILURE;
+	}
+
+	cards = calloc(ncards, sizeof(*cards));
+	queue = calloc(ncards, sizeof(*queue));
+	workers = calloc(opt.workers, sizeof(*workers));
+	if (!cards || !queue || !workers)
+		return EXIT_FAILURE;
+
+	for (i = 0; i < ncards; i++) {
+		cards[i].idx = i;
+		cards[i].sdr.fd = -1;
+		if (card_setup(&cards[i], paths[i])) {
+			ret = EXIT_FAILURE;
+			goto out;
+		}
+	}
+
+	/* No SA_RESTART, a signal must break readers out of read() */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	for (i = 0; i < opt.workers; i++)
+		pthread_create(&workers[i], NULL, worker_thread, NULL);
+	for (i = 0; i < ncards; i++)
+		pthread_create(&cards[i].reader, NULL, reader_thread, &cards[i]);
+
+	last = sdr_time_now();
+	while (!stop) {
+		double now;
+
+		usleep(100000);
+		now = sdr_time_now();
+		if (now - last >= opt.report) {
+			report(now - last);
+			last = now;
+		}
+	}
+
+	pthread_mutex_lock(&pool_lock);
+	pthread_cond_broadcast(&pool_cond);
+	pthread_mutex_unlock(&pool_lock);
+	for (i = 0; i < opt.workers; i++)
+		pthread_join(workers[i], NULL);
+	for (i = 0; i < ncards; i++) {
+		/* Readers blocked in read() are released by the signal */
+		pthread_kill(cards[i].reader, SIGINT);
+		pthread_join(cards[i].reader, NULL);
+	}
+
+out:
+	for (i = 0; i < ncards; i++)
+		card_teardown(&cards[i]);
+	free(cards);
+	free(queue);
+	free(workers);
+	return ret;
+}
@@ -0,0 +1,745 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (c) 2020 Jorge Maidana <jorgem.seq@gmail.com>
+ *
+ * cx88sdr_tcp - rtl_tcp compatible server for /dev/swradioN
+ *
+ * The real stream is converted to 8-bit unsigned IQ (fs/4 mixer, half-band,
+ * decimation by 2) and served with the rtl_tcp wire protocol, so existing
+ * clients connect unmodified. Sample rate requests pick the nearest band,
+ * gain requests map onto V4L2_CID_GAIN.
+ *
+ * A reader thread keeps the device drained at all times and fills a ring of
+ * large blocks. The network side sends whole blocks, with MSG_ZEROCOPY when
+ * the socket supports it. When the client falls behind and the ring is full,
+ * new blocks are dropped instead of stalling the device. After a dropped
+ * block or a skip of the driver the DDC starts over, so its filter history
+ * never spans a gap.
+ *
+ * With -C the same binary is a minimal client that measures throughput,
+ * for testing over loopback.
+ */
+
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <errno.h>
+#include <getopt.h>
+#include <linux/errqueue.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+
+#include "cx88_sdr_ddc.h"
+#include "sdr_dev.h"
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY		60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY		0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY	5
+#endif
+
+/* rtl_tcp commands */
+enum {
+	RTL_SET_FREQ		= 0x01,
+	RTL_SET_SAMPLE_RATE	= 0x02,
+	RTL_SET_GAIN_MODE	= 0x03,
+	RTL_SET_GAIN		= 0x04,
+	RTL_SET_FREQ_CORR	= 0x05,
+	RTL_SET_IF_GAIN		= 0x06,
+	RTL_SET_TEST_MODE	= 0x07,
+	RTL_SET_AGC_MODE	= 0x08,
+	RTL_SET_DIRECT_SAMPLING	= 0x09,
+	RTL_SET_OFFSET_TUNING	= 0x0a,
+	RTL_SET_RTL_XTAL	= 0x0b,
+	RTL_SET_TUNER_XTAL	= 0x0c,
+	RTL_SET_GAIN_BY_INDEX	= 0x0d,
+	RTL_SET_BIAS_TEE	= 0x0e,
+};
+
+#define RTL_TUNER_UNKNOWN	0
+#define CX88SDR_GAIN_STEPS	32
+#define RTL_GAIN_MAX_TENTHS	496	/* Top of the R820T table clients expect */
+#define MAX_CUTS		32	/* The driver queues 32 events of a type */
+
+struct rtl_dongle_info {
+	char		magic[4];
+	uint32_t	tuner_type;
+	uint32_t	tuner_gain_count;
+};
+
+struct block {
+	uint8_t		*data;
+	size_t		len;
+	size_t		sent;
+	uint32_t	zc_seq;		/* Last zerocopy send touching this block */
+};
+
+static struct {
+	uint16_t	port;
+	const char	*addr;
+	unsigned int	block_kib;
+	unsigned int	blocks;
+	uint32_t	pixelformat;
+	int		zerocopy;
+	double		report;
+	/* Client mode */
+	const char	*client;
+	double		duration;
+	double		limit_mbs;
+	uint32_t	client_rate;
+} opt = {
+	.port		= 1234,
+	.addr		= "127.0.0.1",
+	.block_kib	= 256,
+	.blocks		= 32,
+	.zerocopy	= 1,
+	.report		= 5.0,
+	.duration	= 10.0,
+};
+
+static struct sdr_dev sdr;
+static struct block *ring;
+static uint64_t ring_head, ring_send, ring_tail;	/* fill, send, complete */
+static uint32_t zc_done;	/* Zerocopy sends completed on this socket */
+static int client_active;
+static int wake_fd;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct {
+	uint64_t	in_bytes;
+	uint64_t	sent_bytes;
+	uint64_t	blocks;
+	uint64_t	dropped;
+	uint64_t	skips;		/* Driver discontinuities */
+	uint64_t	zc_sends;
+	uint64_t	zc_copied;
+} stats;
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int __attribute__((unused)) sig)
+{
+	stop = 1;
+}
+
+/*
+ * Input pairs into the block at read byte base where data resumed after a
+ * skip of the driver, in order. A skip right at the end of the block is
+ * reported as the pair count.
+ */
+static unsigned int reader_cuts(uint64_t base, size_t pair_len, uint64_t *skipped,
+				size_t *cuts)
+{
+	struct pollfd pfd = { .fd = sdr.fd, .events = POLLPRI };
+	struct v4l2_event ev;
+	unsigned int n = 0;
+
+	if (!sdr.is_v4l2)
+		return 0;
+
+	/* DQEVENT blocks on an empty queue */
+	while (poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLPRI)) {
+		const struct v4l2_event_cx88sdr_discontinuity *d = (const void *)ev.u.data;
+		uint64_t at;
+
+		if (sdr_dev_dqevent(&sdr, &ev))
+			break;
+		if (ev.type != V4L2_EVENT_CX88SDR_DISCONTINUITY)
+			continue;
+
+		*skipped += d->skipped;
+		at = d->offset - *skipped;
+		if (n < MAX_CUTS)
+			cuts[n++] = at > base ? (at - base) / pair_len : 0;
+
+		pthread_mutex_lock(&lock);
+		stats.skips++;
+		pthread_mutex_unlock(&lock);
+	}
+	return n;
+}
+
+static void *reader_thread(void __attribute__((unused)) *arg)
+{
+	size_t ssz = sdr_dev_sample_size(sdr.pixelformat);
+	size_t out_len = (size_t)opt.block_kib * 1024;
+	/* Two real input samples per complex output, two bytes out per pair */
+	size_t in_len = out_len * ssz;
+	size_t pairs = out_len / 2, cuts[MAX_CUTS];
+	uint64_t base = 0, skipped = 0;
+	unsigned int ncuts, k;
+	int reset = 1;
+	struct ddc *ddc;
+	uint8_t *in;
+
+	in = malloc(in_len);
+	ddc = calloc(1, sizeof(*ddc));
+	if (!in || !ddc) {
+		fprintf(stderr, "reader: out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	while (!stop) {
+		struct block *b = NULL;
+		ssize_t ret;
+		size_t done, n;
+
+		ret = sdr_dev_read_full(&sdr, in, in_len);
+		if (ret < (ssize_t)in_len) {
+			fprintf(stderr, "%s: read stopped\n", sdr.path);
+			stop = 1;
+			break;
+		}
+		ncuts = reader_cuts(base, 2 * ssz, &skipped, cuts);
+		base += in_len;
+
+		pthread_mutex_lock(&lock);
+		stats.in_bytes += ret;
+		if (client_active) {
+			if (ring_head - ring_tail < opt.blocks)
+				b = &ring[ring_head % opt.blocks];
+			else
+				stats.dropped++;
+		}
+		pthread_mutex_unlock(&lock);
+		if (!b) {
+			/* The next kept block does not follow this one */
+			reset = 1;
+			continue;
+		}
+
+		for (done = 0, k = 0; done < pairs; done += n) {
+			for (; k < ncuts && cuts[k] <= done; k++)
+				reset = 1;
+			if (reset) {
+				ddc_reset(ddc);
+				reset = 0;
+			}
+			/* Stop at the next skip, it starts over there */
+			n = pairs - done < DDC_BLOCK ? pairs - done : DDC_BLOCK;
+			if (k < ncuts && cuts[k] - done < n)
+				n = cuts[k] - done;
+
+			if (ssz == 2) {
+				ddc_load_u16(ddc, (const ddc_le16 *)in + 2 * done, n);
+				ddc_filter(ddc, n);
+				ddc_store_cu8_from16(ddc, b->data + 2 * done, n);
+			} else {
+				ddc_load_u8(ddc, in + 2 * done, n);
+				ddc_filter(ddc, n);
+				ddc_store_cu8(ddc, b->data + 2 * done, n);
+			}
+		}
+		if (k < ncuts)
+			reset = 1;
+
+		pthread_mutex_lock(&lock);
+		/* The client may have left while the block was converted */
+		if (client_active && &ring[ring_head % opt.blocks] == b) {
+			b->len = out_len;
+			b->sent = 0;
+			ring_head++;
+			stats.blocks++;
+		}
+		pthread_mutex_unlock(&lock);
+		eventfd_write(wake_fd, 1);
+	}
+
+	eventfd_write(wake_fd, 1);
+	free(in);
+	free(ddc);
+	return NULL;
+}
+
+static uint32_t rate_for_request(uint32_t rate)
+{
+	/* The client asks for a complex rate, the device runs at twice that */
+	return rate * 2;
+}
+
+static void handle_command(const uint8_t *cmd)
+{
+	uint32_t param = ((uint32_t)cmd[1] << 24) | (cmd[2] << 16) | (cmd[3] << 8) | cmd[4];
+	int ret, gain;
+
+	switch (cmd[0]) {
+	case RTL_SET_SAMPLE_RATE:
+		ret = sdr_dev_set_rate(&sdr, rate_for_request(param));
+		fprintf(stderr, "sample rate %u requested, %u S/s complex%s\n",
+			param, sdr.rate / 2, ret ? " (failed)" : "");
+		break;
+	case RTL_SET_GAIN:
+		gain = ((int)param * (CX88SDR_GAIN_STEPS - 1) + RTL_GAIN_MAX_TENTHS / 2) /
+		       RTL_GAIN_MAX_TENTHS;
+		if (gain >= CX88SDR_GAIN_STEPS)
+			gain = CX88SDR_GAIN_STEPS - 1;
+		ret = sdr_dev_set_gain(&sdr, gain);
+		fprintf(stderr, "gain %.1f dB requested, step %d%s\n",
+			param / 10.0, gain, ret ? " (failed)" : "");
+		break;
+	case RTL_SET_GAIN_BY_INDEX:
+		gain = param < CX88SDR_GAIN_STEPS ? (int)param : CX88SDR_GAIN_STEPS - 1;
+		ret = sdr_dev_set_gain(&sdr, gain);
+		fprintf(stderr, "gain step %d%s\n", gain, ret ? " (failed)" : "");
+		break;
+	case RTL_SET_GAIN_MODE:
+	case RTL_SET_AGC_MODE:
+		if (param)
+			fprintf(stderr, "automatic gain not supported, using manual gain\n");
+		break;
+	default:
+		/* No tuner: frequency, correction, xtal and the rest do not apply */
+		break;
+	}
+}
+
+static void reap_completions(int sock)
+{
+	char control[128];
+	struct msghdr msg;
+
+	for (;;) {
+		struct sock_extended_err *serr;
+		struct cmsghdr *cm;
+
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		if (recvmsg(sock, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+			break;
+
+		for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+			serr = (struct sock_extended_err *)CMSG_DATA(cm);
+			if (serr->ee_errno || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+				continue;
+
+			pthread_mutex_lock(&lock);
+			if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+				stats.zc_copied += serr->ee_data - serr->ee_info + 1;
+			/* Completions arrive in order, ee_data is the newest send done */
+			zc_done = serr->ee_data + 1;
+			while (ring_tail < ring_send &&
+			       (int32_t)(ring[ring_tail % opt.blocks].zc_seq - serr->ee_data) <= 0)
+				ring_tail++;
+			pthread_mutex_unlock(&lock);
+		}
+	}
+}
+
+static int send_pending(int sock, int zerocopy, uint32_t *zc_next)
+{
+	for (;;) {
+		struct block *b;
+		ssize_t ret;
+
+		pthread_mutex_lock(&lock);
+		if (ring_send == ring_head) {
+			pthread_mutex_unlock(&lock);
+			return 0;
+		}
+		b = &ring[ring_send % opt.blocks];
+		pthread_mutex_unlock(&lock);
+
+		ret = send(sock, b->data + b->sent, b->len - b->sent,
+			   MSG_DONTWAIT | MSG_NOSIGNAL | (zerocopy ? MSG_ZEROCOPY : 0));
+		if (ret < 0) {
+			if (errno == EAGAIN || errno == ENOBUFS)
+				return 0;
+			return -errno;
+		}
+
+		pthread_mutex_lock(&lock);
+		if (zerocopy)
+			b->zc_seq = (*zc_next)++;
+		b->sent += ret;
+		stats.sent_bytes += ret;
+		if (b->sent == b->len) {
+			ring_send++;
+			/* Copying sends are done with the buffer right away */
+			if (!zerocopy)
+				ring_tail = ring_send;
+		}
+		pthread_mutex_unlock(&lock);
+	}
+}
+
+/*
+ * Zerocopy sends keep reading the blocks until the kernel reports them done,
+ * the next client must not get a block the last one may still send from.
+ * A dead peer may never acknowledge, an abortive close then frees the queue.
+ */
+static void drain_zerocopy(int sock, uint32_t zc_next)
+{
+	double end = sdr_time_now() + 2.0;
+	struct linger lin = { .l_onoff = 1, .l_linger = 0 };
+
+	shutdown(sock, SHUT_RD);
+	for (;;) {
+		uint32_t done;
+
+		reap_completions(sock);
+		pthread_mutex_lock(&lock);
+		done = zc_done;
+		pthread_mutex_unlock(&lock);
+		if (done == zc_next)
+			return;
+		if (sdr_time_now() >= end)
+			break;
+		/* A reset socket polls ready for good, just look again */
+		usleep(20000);
+	}
+
+	fprintf(stderr, "zerocopy sends not acknowledged, resetting the connection\n");
+	setsockopt(sock, SOL_SOCKET, SO_LINGER, &lin, sizeof(lin));
+}
+
+static void serve_client(int sock)
+{
+	struct rtl_dongle_info info;
+	uint8_t cmd[5];
+	size_t cmd_len = 0;
+	uint32_t zc_next = 0;
+	int one = 1, zerocopy = 0;
+
+	setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	if (opt.zerocopy && !setsockopt(sock, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)))
+		zerocopy = 1;
+
+	memcpy(info.magic, "RTL0", 4);
+	info.tuner_type = htonl(RTL_TUNER_UNKNOWN);
+	info.tuner_gain_count = htonl(CX88SDR_GAIN_STEPS);
+	if (send(sock, &info, sizeof(info), MSG_NOSIGNAL) != sizeof(info))
+		return;
+
+	pthread_mutex_lock(&lock);
+	ring_head = ring_send = ring_tail = 0;
+	zc_done = 0;
+	client_active = 1;
+	pthread_mutex_unlock(&lock);
+	fprintf(stderr, "client connected%s\n", zerocopy ? ", zerocopy" : "");
+
+	while (!stop) {
+		struct pollfd pfd[2];
+		int pending;
+
+		pthread_mutex_lock(&lock);
+		pending = ring_send != ring_head;
+		pthread_mutex_unlock(&lock);
+
+		pfd[0].fd = sock;
+		pfd[0].events = POLLIN | (pending ? POLLOUT : 0);
+		pfd[1].fd = wake_fd;
+		pfd[1].events = POLLIN;
+		if (poll(pfd, 2, 200) < 0 && errno != EINTR)
+			break;
+
+		if (pfd[1].revents & POLLIN) {
+			eventfd_t val;
+
+			eventfd_read(wake_fd, &val);
+		}
+		if (pfd[0].revents & POLLERR)
+			reap_completions(sock);
+		if (pfd[0].revents & POLLIN) {
+			ssize_t ret = recv(sock, cmd + cmd_len, sizeof(cmd) - cmd_len, 0);
+
+			if (ret <= 0)
+				break;
+			cmd_len += ret;
+			if (cmd_len == sizeof(cmd)) {
+				handle_command(cmd);
+				cmd_len = 0;
+			}
+		}
+		if (zerocopy)
+			reap_completions(sock);
+		if (send_pending(sock, zerocopy, &zc_next))
+			break;
+	}
+
+	pthread_mutex_lock(&lock);
+	client_active = 0;
+	pthread_mutex_unlock(&lock);
+	if (zerocopy)
+		drain_zerocopy(sock, zc_next);
+	fprintf(stderr, "client disconnected\n");
+}
+
+static void report(double elapsed)
+{
+	pthread_mutex_lock(&lock);
+	fprintf(stderr, "in %.2f MB/s, sent %.2f MB/s, %llu blocks, %llu dropped, "
+		"%llu driver skips, %llu zerocopy sends copied\n",
+		stats.in_bytes / elapsed / 1e6, stats.sent_bytes / elapsed / 1e6,
+		(unsigned long long)stats.blocks, (unsigned long long)stats.dropped,
+		(unsigned long long)stats.skips, (unsigned long long)stats.zc_copied);
+	stats.in_bytes = 0;
+	stats.sent_bytes = 0;
+	pthread_mutex_unlock(&lock);
+}
+
+static void *report_thread(void __attribute__((unused)) *arg)
+{
+	double last = sdr_time_now();
+
+	while (!stop) {
+		double now;
+
+		usleep(100000);
+		now = sdr_time_now();
+		if (now - last >= opt.report) {
+			report(now - last);
+			last = now;
+		}
+	}
+	return NULL;
+}
+
+static int run_server(const char *path)
+{
+	struct sockaddr_in addr;
+	pthread_t reader, reporter;
+	unsigned int i;
+	int lsock, one = 1, ret;
+
+	ret = sdr_dev_open(&sdr, path, 0);
+	if (ret) {
+		fprintf(stderr, "%s: %s\n", path, strerror(-ret));
+		return EXIT_FAILURE;
+	}
+	if (opt.pixelformat && (ret = sdr_dev_set_format(&sdr, opt.pixelformat)))
+		fprintf(stderr, "can't set format: %s\n", strerror(-ret));
+	/* The DDC starts over wherever the driver skipped data */
+	if (sdr.is_v4l2 && (ret = sdr_dev_subscribe(&sdr, V4L2_EVENT_CX88SDR_DISCONTINUITY)))
+		fprintf(stderr, "can't subscribe to discontinuities: %s\n", strerror(-ret));
+
+	ring = calloc(opt.blocks, sizeof(*ring));
+	if (!ring)
+		return EXIT_FAILURE;
+	for (i = 0; i < opt.blocks; i++) {
+		ring[i].data = malloc((size_t)opt.block_kib * 1024);
+		if (!ring[i].data)
+			return EXIT_FAILURE;
+	}
+
+	wake_fd = eventfd(0, EFD_NONBLOCK);
+	lsock = socket(AF_INET, SOCK_STREAM, 0);
+	if (wake_fd < 0 || lsock < 0)
+		return EXIT_FAILURE;
+	setsockopt(lsock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(opt.port);
+	if (inet_pton(AF_INET, opt.addr, &addr.sin_addr) != 1 ||
+	    bind(lsock, (struct sockaddr *)&addr, sizeof(addr)) || listen(lsock, 1)) {
+		fprintf(stderr, "%s:%u: %s\n", opt.addr, opt.port, strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	fprintf(stderr, "%s: %s, %u S/s real, serving %u S/s CU8 on %s:%u\n",
+		sdr.path, sdr_dev_format_name(sdr.pixelformat), sdr.rate,
+		sdr.rate / 2, opt.addr, opt.port);
+
+	pthread_create(&reader, NULL, reader_thread, NULL);
+	pthread_create(&reporter, NULL, report_thread, NULL);
+
+	while (!stop) {
+		struct pollfd pfd = { .fd = lsock, .events = POLLIN };
+		int sock;
+
+		if (poll(&pfd, 1, 200) <= 0)
+			continue;
+		sock = accept(lsock, NULL, NULL);
+		if (sock < 0)
+			continue;
+		serve_client(sock);
+		close(sock);
+	}
+
+	stop = 1;
+	pthread_join(reporter, NULL);
+	/* The reader may sit in a blocking read, the signal releases it */
+	pthread_kill(reader, SIGINT);
+	pthread_join(reader, NULL);
+	close(lsock);
+	sdr_dev_close(&sdr);
+	return EXIT_SUCCESS;
+}
+
+static int run_client(void)
+{
+	struct rtl_dongle_info info;
+	struct addrinfo hints, *res;
+	char port[8];
+	uint8_t *buf;
+	uint64_t total = 0, interval = 0;
+	double t0, last;
+	size_t len = 1 << 20;
+	int sock;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	snprintf(port, sizeof(port), "%u", opt.port);
+	if (getaddrinfo(opt.client, port, &hints, &res)) {
+		fprintf(stderr, "%s: can't resolve\n", opt.client);
+		return EXIT_FAILURE;
+	}
+	sock = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+	if (sock < 0 || connect(sock, res->ai_addr, res->ai_addrlen)) {
+		fprintf(stderr, "%s:%s: %s\n", opt.client, port, strerror(errno));
+		return EXIT_FAILURE;
+	}
+	freeaddrinfo(res);
+
+	if (recv(sock, &info, sizeof(info), MSG_WAITALL) != sizeof(info) ||
+	    memcmp(info.magic, "RTL0", 4)) {
+		fprintf(stderr, "not an rtl_tcp server\n");
+		return EXIT_FAILURE;
+	}
+	fprintf(stderr, "tuner %u, %u gains\n", ntohl(info.tuner_type),
+		ntohl(info.tuner_gain_count));
+
+	if (opt.client_rate) {
+		uint8_t cmd[5] = { RTL_SET_SAMPLE_RATE, opt.client_rate >> 24,
+				   opt.client_rate >> 16, opt.client_rate >> 8,
+				   opt.client_rate };
+
+		send(sock, cmd, sizeof(cmd), 0);
+	}
+
+	buf = malloc(len);
+	if (!buf)
+		return EXIT_FAILURE;
+	t0 = last = sdr_time_now();
+	while (!stop) {
+		double now = sdr_time_now();
+		ssize_t ret;
+
+		if (now - t0 >= opt.duration)
+			break;
+		/* Throttle to provoke backpressure on the server */
+		if (opt.limit_mbs > 0.0 && total > opt.limit_mbs * 1e6 * (now - t0)) {
+			usleep(1000);
+			continue;
+		}
+		ret = recv(sock, buf, len, 0);
+		if (ret <= 0)
+			break;
+		total += ret;
+		interval += ret;
+		if (now - last >= opt.report) {
+			fprintf(stderr, "%.2f MB/s\n", interval / (now - last) / 1e6);
+			interval = 0;
+			last = now;
+		}
+	}
+	fprintf(stderr, "received %llu bytes, %.2f MB/s\n", (unsigned long long)total,
+		total / (sdr_time_now() - t0) / 1e6);
+	free(buf);
+	close(sock);
+	return EXIT_SUCCESS;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [options] <device>\n"
+		"       %s -C <host> [options]\n"
+		"  -a <addr>   Listen address (default %s)\n"
+		"  -p <port>   Port (default %u)\n"
+		"  -f <fmt>    Capture format: ru8, ru16\n"
+		"  -b <kib>    Block size in KiB (default %u)\n"
+		"  -n <num>    Blocks buffered per client (default %u)\n"
+		"  -Z          Disable MSG_ZEROCOPY\n"
+		"  -r <sec>    Report period (default %.1f)\n"
+		"Client mode:\n"
+		"  -C <host>   Connect to a server and measure throughput\n"
+		"  -t <sec>    Duration (default %.1f)\n"
+		"  -l <MB/s>   Throttle reception\n"
+		"  -s <rate>   Request a complex sample rate\n",
+		prog, prog, opt.addr, opt.port, opt.block_kib, opt.blocks,
+		opt.report, opt.duration);
+}
+
+int main(int argc, char **argv)
+{
+	struct sigaction sa;
+	int c;
+
+	while ((c = getopt(argc, argv, "a:p:f:b:n:Zr:C:t:l:s:h")) != -1) {
+		switch (c) {
+		case 'a':
+			opt.addr = optarg;
+			break;
+		case 'p':
+			opt.port = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			opt.pixelformat = sdr_dev_parse_format(optarg);
+			if (!opt.pixelformat || sdr_dev_format_is_complex(opt.pixelformat)) {
+				fprintf(stderr, "unsupported format %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'b':
+			opt.block_kib = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			opt.blocks = strtoul(optarg, NULL, 0);
+			break;
+		case 'Z':
+			opt.zerocopy = 0;
+			break;
+		case 'r':
+			opt.report = strtod(optarg, NULL);
+			break;
+		case 'C':
+			opt.client = optarg;
+			break;
+		case 't':
+			opt.duration = strtod(optarg, NULL);
+			break;
+		case 'l':
+			opt.limit_mbs = strtod(optarg, NULL);
+			break;
+		case 's':
+			opt.client_rate = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	/* No SA_RESTART, a signal must break the reader out of read() */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	if (opt.client)
+		return run_client();
+
+	/* Each block must hold whole DDC passes */
+	if (optind != argc - 1 || !opt.block_kib || opt.blocks < 2 ||
+	    opt.report <= 0.0 || (opt.block_kib * 1024) % (2 * DDC_BLOCK)) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	return run_server(argv[optind]);
+}
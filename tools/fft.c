@@ -0,0 +1,203 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (c) 2020 Jorge Maidana <jorgem.seq@gmail.com>
+ *
+ * Radix-2 FFTs on split (separate re/im) arrays.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "fft.h"
+
+static int is_pow2(unsigned int n)
+{
+	return n && !(n & (n - 1));
+}
+
+int cfft_init(struct cfft *f, unsigned int n)
+{
+	unsigned int i, bits = 0;
+
+	if (!is_pow2(n) || n < 2)
+		return -1;
+
+	f->n = n;
+	f->rev = calloc(n, sizeof(*f->rev));
+	f->cos_tab = calloc(n / 2, sizeof(float));
+	f->sin_tab = calloc(n / 2, sizeof(float));
+	f->tw_re = calloc(n / 2, sizeof(float));
+	f->tw_im = calloc(n / 2, sizeof(float));
+	if (!f->rev || !f->cos_tab || !f->sin_tab || !f->tw_re || !f->tw_im) {
+		cfft_free(f);
+		return -1;
+	}
+
+	while ((1u << bits) < n)
+		bits++;
+	for (i = 0; i < n; i++) {
+		unsigned int b, r = 0;
+
+		for (b = 0; b < bits; b++)
+			r |= ((i >> b) & 1) << (bits - 1 - b);
+		f->rev[i] = r;
+	}
+	for (i = 0; i < n / 2; i++) {
+		f->cos_tab[i] = cos(2 * M_PI * i / n);
+		f->sin_tab[i] = sin(2 * M_PI * i / n);
+	}
+	return 0;
+}
+
+void cfft_free(struct cfft *f)
+{
+	free(f->rev);
+	free(f->cos_tab);
+	free(f->sin_tab);
+	free(f->tw_re);
+	free(f->tw_im);
+	f->rev = NULL;
+	f->cos_tab = f->sin_tab = f->tw_re = f->tw_im = NULL;
+}
+
+void cfft_run(const struct cfft *f, float *re, float *im, int inverse)
+{
+	unsigned int n = f->n, i, k, len;
+	float sign = inverse ? 1.0f : -1.0f;
+
+	for (i = 0; i < n; i++) {
+		unsigned int r = f->rev[i];
+
+		if (r > i) {
+			float t;
+
+			t = re[i]; re[i] = re[r]; re[r] = t;
+			t = im[i]; im[i] = im[r]; im[r] = t;
+		}
+	}
+
+	for (len = 2; len <= n; len <<= 1) {
+		unsigned int half = len / 2, step = n / len;
+		float *wr = f->tw_re, *wi = f->tw_im;
+
+		/* Gather the stage twiddles so the butterflies are unit-stride */
+		for (k = 0; k < half; k++) {
+			wr[k] = f->cos_tab[k * step];
+			wi[k] = sign * f->sin_tab[k * step];
+		}
+
+		for (i = 0; i < n; i += len) {
+			float *ar = re + i, *ai = im + i;
+			float *br = re + i + half, *bi = im + i + half;
+
+			for (k = 0; k < half; k++) {
+				float tr = br[k] * wr[k] - bi[k] * wi[k];
+				float ti = br[k] * wi[k] + bi[k] * wr[k];
+
+				br[k] = ar[k] - tr;
+				bi[k] = ai[k] - ti;
+				ar[k] += tr;
+				ai[k] += ti;
+			}
+		}
+	}
+}
+
+int rfft_init(struct rfft *f, unsigned int n)
+{
+	unsigned int i;
+
+	if (!is_pow2(n) || n < 4)
+		return -1;
+	if (cfft_init(&f->half, n / 2))
+		return -1;
+
+	f->n = n;
+	f->cos_tab = calloc(n / 2, sizeof(float));
+	f->sin_tab = calloc(n / 2, sizeof(float));
+	f->re = calloc(n / 2 + 1, sizeof(float));
+	f->im = calloc(n / 2 + 1, sizeof(float));
+	if (!f->cos_tab || !f->sin_tab || !f->re || !f->im) {
+		rfft_free(f);
+		return -1;
+	}
+	for (i = 0; i < n / 2; i++) {
+		f->cos_tab[i] = cos(2 * M_PI * i / n);
+		f->sin_tab[i] = sin(2 * M_PI * i / n);
+	}
+	return 0;
+}
+
+void rfft_free(struct rfft *f)
+{
+	cfft_free(&f->half);
+	free(f->cos_tab);
+	free(f->sin_tab);
+	free(f->re);
+	free(f->im);
+	f->cos_tab = f->sin_tab = f->re = f->im = NULL;
+}
+
+void rfft_run(struct rfft *f, const float *in)
+{
+	unsigned int m = f->n / 2, k;
+	float *re = f->re, *im = f->im;
+	float z0r, z0i;
+
+	/* Pack even/odd samples as one complex sequence of half the length */
+	for (k = 0; k < m; k++) {
+		re[k] = in[2 * k];
+		im[k] = in[2 * k + 1];
+	}
+	cfft_run(&f->half, re, im, 0);
+
+	z0r = re[0];
+	z0i = im[0];
+
+	/* Split Z[k] and Z[m - k] into the even and odd spectra, pairwise */
+	for (k = 1; k < m / 2; k++) {
+		unsigned int j = m - k;
+		float ar = re[k], ai = im[k], cr = re[j], ci = im[j];
+		float er, ei, or, oi;
+
+		/* Bin k */
+		er = 0.5f * (ar + cr);
+		ei = 0.5f * (ai - ci);
+		or = 0.5f * (ai + ci);
+		oi = 0.5f * (cr - ar);
+		re[k] = er + f->cos_tab[k] * or + f->sin_tab[k] * oi;
+		im[k] = ei + f->cos_tab[k] * oi - f->sin_tab[k] * or;
+
+		/* Bin m - k */
+		er = 0.5f * (cr + ar);
+		ei = 0.5f * (ci - ai);
+		or = 0.5f * (ci + ai);
+		oi = 0.5f * (ar - cr);
+		re[j] = er + f->cos_tab[j] * or + f->sin_tab[j] * oi;
+		im[j] = ei + f->cos_tab[j] * oi - f->sin_tab[j] * or;
+	}
+	/* Bin m / 2 pairs with itself, its twiddle is -j */
+	im[m / 2] = -im[m / 2];
+
+	re[0] = z0r + z0i;
+	im[0] = 0.0f;
+	re[m] = z0r - z0i;
+	im[m] = 0.0f;
+}
+
+void rfft_power(struct rfft *f, const float *in, float *pow)
+{
+	unsigned int k;
+
+	rfft_run(f, in);
+	for (k = 0; k <= f->n / 2; k++)
+		pow[k] = f->re[k] * f->re[k] + f->im[k] * f->im[k];
+}
+
+void fft_hann(float *win, unsigned int n)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++)
+		win[i] = 0.5f - 0.5f * cos(2 * M_PI * i / n);
+}
@@ -0,0 +1,44 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (c) 2020 Jorge Maidana <jorgem.seq@gmail.com>
+ *
+ * Radix-2 FFTs on split (separate re/im) arrays. The inner loops are kept
+ * branch free and unit-stride so the compiler can vectorize them.
+ */
+
+#ifndef SDR_FFT_H
+#define SDR_FFT_H
+
+struct cfft {
+	unsigned int	n;
+	unsigned int	*rev;
+	float		*cos_tab;	/* n / 2 twiddles */
+	float		*sin_tab;
+	float		*tw_re;		/* Per-stage twiddle scratch */
+	float		*tw_im;
+};
+
+/* Real input FFT of size n via a complex FFT of size n / 2 */
+struct rfft {
+	unsigned int	n;
+	struct cfft	half;
+	float		*cos_tab;	/* n / 2 post-processing twiddles */
+	float		*sin_tab;
+	float		*re;		/* Scratch, n / 2 + 1 */
+	float		*im;
+};
+
+int cfft_init(struct cfft *f, unsigned int n);
+void cfft_free(struct cfft *f);
+void cfft_run(const struct cfft *f, float *re, float *im, int inverse);
+
+int rfft_init(struct rfft *f, unsigned int n);
+void rfft_free(struct rfft *f);
+/* Leaves the n / 2 + 1 spectrum bins in f->re and f->im */
+void rfft_run(struct rfft *f, const float *in);
+void rfft_power(struct rfft *f, const float *in, float *pow);
+
+/* Periodic Hann window */
+void fft_hann(float *win, unsigned int n);
+
+#endif
@@ -0,0 +1,305 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (c) 2020 Jorge Maidana <jorgem.seq@gmail.com>
+ *
+ * Small helpers shared by the cx88_sdr user space tools.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include "sdr_dev.h"
+
+static int xioctl(int fd, unsigned long req, void *arg)
+{
+	int ret;
+
+	do {
+		ret = ioctl(fd, req, arg);
+	} while (ret < 0 && errno == EINTR);
+	return ret;
+}
+
+static int sdr_dev_query(struct sdr_dev *sdr)
+{
+	struct v4l2_format fmt;
+	struct v4l2_frequency freq;
+
+	memset(&fmt, 0, sizeof(fmt));
+	fmt.type = V4L2_BUF_TYPE_SDR_CAPTURE;
+	if (xioctl(sdr->fd, VIDIOC_G_FMT, &fmt) < 0)
+		return -errno;
+	sdr->pixelformat = fmt.fmt.sdr.pixelformat;
+
+	memset(&freq, 0, sizeof(freq));
+	freq.tuner = 0;
+	if (xioctl(sdr->fd, VIDIOC_G_FREQUENCY, &freq) < 0)
+		return -errno;
+	sdr->rate = freq.frequency;
+	return 0;
+}
+
+/*
+ * Anything that is not a V4L2 SDR node (a FIFO, a raw capture file) is
+ * accepted as a plain RU8 source so the tools can be tried without a card.
+ */
+int sdr_dev_open(struct sdr_dev *sdr, const char *path, int flags)
+{
+	struct v4l2_capability cap;
+
+	memset(sdr, 0, sizeof(*sdr));
+	sdr->path = path;
+	sdr->pixelformat = V4L2_SDR_FMT_RU8;
+	sdr->rate = SDR_DEV_DEFAULT_RATE;
+
+	sdr->fd = open(path, O_RDONLY | flags);
+	if (sdr->fd < 0)
+		return -errno;
+
+	memset(&cap, 0, sizeof(cap));
+	if (xioctl(sdr->fd, VIDIOC_QUERYCAP, &cap) < 0)
+		return 0;
+
+	if (!(cap.device_caps & V4L2_CAP_SDR_CAPTURE)) {
+		close(sdr->fd);
+		sdr->fd = -1;
+		return -ENODEV;
+	}
+
+	sdr->is_v4l2 = 1;
+	return sdr_dev_query(sdr);
+}
+
+void sdr_dev_close(struct sdr_dev *sdr)
+{
+	if (sdr->fd >= 0)
+		close(sdr->fd);
+	sdr->fd = -1;
+}
+
+int sdr_dev_set_format(struct sdr_dev *sdr, uint32_t pixelformat)
+{
+	struct v4l2_format fmt;
+
+	if (!sdr->is_v4l2) {
+		sdr->pixelformat = pixelformat;
+		return 0;
+	}
+
+	memset(&fmt, 0, sizeof(fmt));
+	fmt.type = V4L2_BUF_TYPE_SDR_CAPTURE;
+	fmt.fmt.sdr.pixelformat = pixelformat;
+	if (xioctl(sdr->fd, VIDIOC_S_FMT, &fmt) < 0)
+		return -errno;
+	if (fmt.fmt.sdr.pixelformat != pixelformat)
+		return -EINVAL;
+
+	/* The bands follow the sample width */
+	return sdr_dev_query(sdr);
+}
+
+int sdr_dev_set_rate(struct sdr_dev *sdr, uint32_t rate)
+{
+	struct v4l2_frequency freq;
+
+	if (!sdr->is_v4l2) {
+		sdr->rate = rate;
+		return 0;
+	}
+
+	memset(&freq, 0, sizeof(freq));
+	freq.tuner = 0;
+	freq.type = V4L2_TUNER_SDR;
+	freq.frequency = rate;
+	if (xioctl(sdr->fd, VIDIOC_S_FREQUENCY, &freq) < 0)
+		return -errno;
+	return sdr_dev_query(sdr);
+}
+
+static int sdr_dev_set_ctrl(struct sdr_dev *sdr, uint32_t id, int val)
+{
+	struct v4l2_control ctrl;
+
+	if (!sdr->is_v4l2)
+		return 0;
+
+	ctrl.id = id;
+	ctrl.value = val;
+	if (xioctl(sdr->fd, VIDIOC_S_CTRL, &ctrl) < 0)
+		return -errno;
+	return 0;
+}
+
+int sdr_dev_set_gain(struct sdr_dev *sdr, int gain)
+{
+	return sdr_dev_set_ctrl(sdr, V4L2_CID_GAIN, gain);
+}
+
+int sdr_dev_set_input(struct sdr_dev *sdr, int input)
+{
+	return sdr_dev_set_ctrl(sdr, V4L2_CID_CX88SDR_INPUT, input);
+}
+
+/* Reads jump to the live edge when they lag more than usec, 0 disables it */
+int sdr_dev_set_max_latency(struct sdr_dev *sdr, int usec)
+{
+	if (!sdr->is_v4l2)
+		return -ENOTTY;
+	return sdr_dev_set_ctrl(sdr, V4L2_CID_CX88SDR_MAX_LATENCY, usec);
+}
+
+/* Applies to handles opened afterwards */
+int sdr_dev_set_start_oldest(struct sdr_dev *sdr, int oldest)
+{
+	if (!sdr->is_v4l2)
+		return -ENOTTY;
+	return sdr_dev_set_ctrl(sdr, V4L2_CID_CX88SDR_START, oldest);
+}
+
+int sdr_dev_get_gain(struct sdr_dev *sdr)
+{
+	struct v4l2_control ctrl;
+
+	if (!sdr->is_v4l2)
+		return -ENOTTY;
+
+	ctrl.id = V4L2_CID_GAIN;
+	ctrl.value = 0;
+	if (xioctl(sdr->fd, VIDIOC_G_CTRL, &ctrl) < 0)
+		return -errno;
+	return ctrl.value;
+}
+
+/* For the 64-bit counters, FIFO Overflows and the like */
+int sdr_dev_get_ctrl64(struct sdr_dev *sdr, uint32_t id, int64_t *val)
+{
+	struct v4l2_ext_controls ctrls;
+	struct v4l2_ext_control ctrl;
+
+	if (!sdr->is_v4l2)
+		return -ENOTTY;
+
+	memset(&ctrls, 0, sizeof(ctrls));
+	memset(&ctrl, 0, sizeof(ctrl));
+	ctrl.id = id;
+	ctrls.which = V4L2_CTRL_ID2WHICH(id);
+	ctrls.count = 1;
+	ctrls.controls = &ctrl;
+	if (xioctl(sdr->fd, VIDIOC_G_EXT_CTRLS, &ctrls) < 0)
+		return -errno;
+	*val = ctrl.value64;
+	return 0;
+}
+
+int sdr_dev_subscribe(struct sdr_dev *sdr, uint32_t type)
+{
+	struct v4l2_event_subscription sub;
+
+	if (!sdr->is_v4l2)
+		return -ENOTTY;
+
+	memset(&sub, 0, sizeof(sub));
+	sub.type = type;
+	if (xioctl(sdr->fd, VIDIOC_SUBSCRIBE_EVENT, &sub) < 0)
+		return -errno;
+	return 0;
+}
+
+/* Returns -ENOENT once the queue is empty */
+int sdr_dev_dqevent(struct sdr_dev *sdr, struct v4l2_event *ev)
+{
+	memset(ev, 0, sizeof(*ev));
+	if (xioctl(sdr->fd, VIDIOC_DQEVENT, ev) < 0)
+		return -errno;
+	return 0;
+}
+
+ssize_t sdr_dev_read_full(struct sdr_dev *sdr, void *buf, size_t len)
+{
+	size_t done = 0;
+
+	while (done < len) {
+		ssize_t ret = read(sdr->fd, (char *)buf + done, len - done);
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return done ? (ssize_t)done : -errno;
+		}
+		if (ret == 0)
+			break;
+		done += ret;
+	}
+	return done;
+}
+
+static const struct {
+	const char	*name;
+	uint32_t	pixelformat;
+} sdr_formats[] = {
+	{ "ru8",	V4L2_SDR_FMT_RU8 },
+	{ "ru16",	V4L2_SDR_FMT_RU16LE },
+	{ "cs8",	V4L2_SDR_FMT_CS8 },
+	{ "cs16",	V4L2_SDR_FMT_CS16LE },
+};
+
+uint32_t sdr_dev_parse_format(const char *name)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(sdr_formats) / sizeof(sdr_formats[0]); i++)
+		if (!strcasecmp(name, sdr_formats[i].name))
+			return sdr_formats[i].pixelformat;
+	return 0;
+}
+
+const char *sdr_dev_format_name(uint32_t pixelformat)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(sdr_formats) / sizeof(sdr_formats[0]); i++)
+		if (sdr_formats[i].pixelformat == pixelformat)
+			return sdr_formats[i].name;
+	return "unknown";
+}
+
+size_t sdr_dev_sample_size(uint32_t pixelformat)
+{
+	switch (pixelformat) {
+	case V4L2_SDR_FMT_RU16LE:
+	case V4L2_SDR_FMT_CS8:
+		return 2;
+	case V4L2_SDR_FMT_CS16LE:
+		return 4;
+	default:
+		return 1;
+	}
+}
+
+int sdr_dev_format_is_complex(uint32_t pixelformat)
+{
+	return pixelformat == V4L2_SDR_FMT_CS8 || pixelformat == V4L2_SDR_FMT_CS16LE;
+}
+
+double sdr_time_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+double sdr_thread_cpu_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
@@ -0,0 +1,53 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (c) 2020 Jorge Maidana <jorgem.seq@gmail.com>
+ *
+ * Small helpers shared by the cx88_sdr user space tools.
+ */
+
+#ifndef SDR_DEV_H
+#define SDR_DEV_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "cx88_sdr_uapi.h"
+
+#define SDR_DEV_DEFAULT_RATE	28636363
+#define SDR_MAX_DEVICES		32
+
+struct sdr_dev {
+	int		fd;
+	const char	*path;
+	int		is_v4l2;	/* 0 for plain files and FIFOs */
+	uint32_t	pixelformat;
+	uint32_t	rate;		/* Samples per second */
+};
+
+int sdr_dev_open(struct sdr_dev *sdr, const char *path, int flags);
+void sdr_dev_close(struct sdr_dev *sdr);
+
+int sdr_dev_set_format(struct sdr_dev *sdr, uint32_t pixelformat);
+int sdr_dev_set_rate(struct sdr_dev *sdr, uint32_t rate);
+int sdr_dev_set_gain(struct sdr_dev *sdr, int gain);
+int sdr_dev_set_input(struct sdr_dev *sdr, int input);
+int sdr_dev_set_max_latency(struct sdr_dev *sdr, int usec);
+int sdr_dev_set_start_oldest(struct sdr_dev *sdr, int oldest);
+int sdr_dev_get_gain(struct sdr_dev *sdr);
+int sdr_dev_get_ctrl64(struct sdr_dev *sdr, uint32_t id, int64_t *val);
+
+int sdr_dev_subscribe(struct sdr_dev *sdr, uint32_t type);
+int sdr_dev_dqevent(struct sdr_dev *sdr, struct v4l2_event *ev);
+
+ssize_t sdr_dev_read_full(struct sdr_dev *sdr, void *buf, size_t len);
+
+uint32_t sdr_dev_parse_format(const char *name);
+const char *sdr_dev_format_name(uint32_t pixelformat);
+size_t sdr_dev_sample_size(uint32_t pixelformat);
+int sdr_dev_format_is_complex(uint32_t pixelformat);
+
+double sdr_time_now(void);
+double sdr_thread_cpu_time(void);
+
+#endif
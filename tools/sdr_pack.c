@@ -0,0 +1,235 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (c) 2020 Jorge Maidana <jorgem.seq@gmail.com>
+ *
+ * Lossless delta / frame of reference bit-packing of RU8 and RU16LE
+ * samples. Every block is a fixed 64 sample loop without data dependent
+ * branches inside, which the compiler vectorizes well.
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include "sdr_pack.h"
+
+static inline unsigned int bit_width(uint32_t v)
+{
+	return v ? 32 - __builtin_clz(v) : 0;
+}
+
+static inline uint32_t zigzag(int32_t v)
+{
+	return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static inline int32_t unzigzag(uint32_t v)
+{
+	return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+static inline void load_block(const void *src, size_t first, unsigned int n,
+			      size_t ssize, uint32_t *x)
+{
+	unsigned int j;
+
+	if (ssize == 2) {
+		const uint8_t *s = (const uint8_t *)src + first * 2;
+
+		for (j = 0; j < n; j++)
+			x[j] = s[2 * j] | (s[2 * j + 1] << 8);
+	} else {
+		const uint8_t *s = (const uint8_t *)src + first;
+
+		for (j = 0; j < n; j++)
+			x[j] = s[j];
+	}
+}
+
+static inline void store_block(void *dst, size_t first, unsigned int n,
+			       size_t ssize, const uint32_t *x)
+{
+	unsigned int j;
+
+	if (ssize == 2) {
+		uint8_t *d = (uint8_t *)dst + first * 2;
+
+		for (j = 0; j < n; j++) {
+			d[2 * j] = x[j];
+			d[2 * j + 1] = x[j] >> 8;
+		}
+	} else {
+		uint8_t *d = (uint8_t *)dst + first;
+
+		for (j = 0; j < n; j++)
+			d[j] = x[j];
+	}
+}
+
+/* Writes exactly (n * bits + 7) / 8 bytes */
+static uint8_t *put_bits(uint8_t *p, const uint32_t *v, unsigned int n, unsigned int bits)
+{
+	uint64_t acc = 0;
+	unsigned int fill = 0, i;
+
+	if (!bits)
+		return p;
+
+	for (i = 0; i < n; i++) {
+		acc |= (uint64_t)v[i] << fill;
+		fill += bits;
+		if (fill >= 32) {
+			p[0] = acc;
+			p[1] = acc >> 8;
+			p[2] = acc >> 16;
+			p[3] = acc >> 24;
+			p += 4;
+			acc >>= 32;
+			fill -= 32;
+		}
+	}
+	for (; fill; fill = fill > 8 ? fill - 8 : 0, acc >>= 8)
+		*p++ = acc;
+	return p;
+}
+
+/* May read up to 3 bytes past the coded bits, see SDR_PACK_PAD */
+static const uint8_t *get_bits(const uint8_t *p, uint32_t *v, unsigned int n,
+			       unsigned int bits)
+{
+	const uint8_t *end = p + (n * bits + 7) / 8;
+	uint32_t mask = (1u << bits) - 1;
+	uint64_t acc = 0;
+	unsigned int fill = 0, i;
+
+	if (!bits) {
+		memset(v, 0, n * sizeof(*v));
+		return p;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (fill < bits) {
+			acc |= (uint64_t)(p[0] | (p[1] << 8) | (p[2] << 16) |
+					  ((uint32_t)p[3] << 24)) << fill;
+			p += 4;
+			fill += 32;
+		}
+		v[i] = acc & mask;
+		acc >>= bits;
+		fill -= bits;
+	}
+	return end;
+}
+
+size_t sdr_pack_bound(size_t samples, size_t ssize)
+{
+	size_t blocks = (samples + SDR_PACK_BLOCK - 1) / SDR_PACK_BLOCK;
+
+	/* Header, a FOR base and 64 deltas of one bit more than a sample */
+	return blocks * (1 + ssize + SDR_PACK_BLOCK * (8 * ssize + 1) / 8);
+}
+
+size_t sdr_pack(const void *src, size_t samples, size_t ssize, uint8_t *dst)
+{
+	uint32_t x[SDR_PACK_BLOCK], v[SDR_PACK_BLOCK];
+	uint32_t prev = ssize == 2 ? 0x8000 : 0x80;
+	uint8_t *p = dst;
+	size_t i;
+
+	for (i = 0; i < samples; i += SDR_PACK_BLOCK) {
+		unsigned int n = samples - i < SDR_PACK_BLOCK ? samples - i : SDR_PACK_BLOCK;
+		uint32_t lo = UINT32_MAX, hi = 0, any = 0;
+		unsigned int j, dbits, fbits;
+
+		load_block(src, i, n, ssize, x);
+
+		for (j = 0; j < n; j++) {
+			v[j] = zigzag((int32_t)x[j] - (int32_t)(j ? x[j - 1] : prev));
+			any |= v[j];
+			lo = x[j] < lo ? x[j] : lo;
+			hi = x[j] > hi ? x[j] : hi;
+		}
+		prev = x[n - 1];
+
+		dbits = bit_width(any);
+		fbits = bit_width(hi - lo);
+		if ((n * fbits + 7) / 8 + ssize < (n * dbits + 7) / 8) {
+			*p++ = SDR_PACK_FOR | fbits;
+			*p++ = lo;
+			if (ssize == 2)
+				*p++ = lo >> 8;
+			for (j = 0; j < n; j++)
+				v[j] = x[j] - lo;
+			p = put_bits(p, v, n, fbits);
+		} else {
+			*p++ = dbits;
+			p = put_bits(p, v, n, dbits);
+		}
+	}
+	return p - dst;
+}
+
+int sdr_unpack(const uint8_t *src, size_t len, size_t samples, size_t ssize, void *dst)
+{
+	uint32_t x[SDR_PACK_BLOCK], v[SDR_PACK_BLOCK];
+	uint32_t prev = ssize == 2 ? 0x8000 : 0x80;
+	uint32_t mask = ssize == 2 ? 0xffff : 0xff;
+	const uint8_t *p = src, *end = src + len;
+	size_t i;
+
+	for (i = 0; i < samples; i += SDR_PACK_BLOCK) {
+		unsigned int n = samples - i < SDR_PACK_BLOCK ? samples - i : SDR_PACK_BLOCK;
+		unsigned int j, bits, hdr;
+		uint32_t lo = 0;
+
+		if (p >= end)
+			return -EINVAL;
+		hdr = *p++;
+		bits = hdr & 0x1f;
+		if (bits > 8 * ssize + 1)
+			return -EINVAL;
+
+		if (hdr & SDR_PACK_FOR) {
+			if ((size_t)(end - p) < ssize)
+				return -EINVAL;
+			lo = *p++;
+			if (ssize == 2)
+				lo |= *p++ << 8;
+		}
+		if ((size_t)(end - p) < (n * bits + 7) / 8)
+			return -EINVAL;
+		p = get_bits(p, v, n, bits);
+
+		if (hdr & SDR_PACK_FOR) {
+			for (j = 0; j < n; j++)
+				x[j] = (lo + v[j]) & mask;
+		} else {
+			for (j = 0; j < n; j++) {
+				prev = (prev + unzigzag(v[j])) & mask;
+				x[j] = prev;
+			}
+		}
+		prev = x[n - 1];
+
+		store_block(dst, i, n, ssize, x);
+	}
+	return p == end ? 0 : -EINVAL;
+}
+
+uint32_t sdr_adler32(const uint8_t *buf, size_t len)
+{
+	uint32_t a = 1, b = 0;
+
+	while (len) {
+		/* Largest run before b can overflow */
+		size_t n = len < 5552 ? len : 5552;
+
+		len -= n;
+		while (n--) {
+			a += *buf++;
+			b += a;
+		}
+		a %= 65521;
+		b %= 65521;
+	}
+	return (b << 16) | a;
+}
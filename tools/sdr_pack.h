@@ -0,0 +1,73 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (c) 2020 Jorge Maidana <jorgem.seq@gmail.com>
+ *
+ * Lossless sample codec and file layout of cx88sdr_rec recordings.
+ */
+
+#ifndef SDR_PACK_H
+#define SDR_PACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Samples are coded in blocks of 64. Each block starts with one byte: the
+ * bit width in the low 5 bits and the mode in bit 7. Delta mode stores the
+ * zigzag coded difference to the previous sample, frame of reference mode
+ * stores the block minimum (1 or 2 bytes) and the offsets to it, whichever
+ * is smaller. 64 values of b bits are exactly 8 * b bytes, a short last
+ * block is rounded up to whole bytes.
+ *
+ * CS8/CS16LE recordings code the I and Q parts as single values, their
+ * sign bits flipped to offset binary in packed frames.
+ */
+#define SDR_PACK_BLOCK		64
+#define SDR_PACK_FOR		0x80
+#define SDR_PACK_PAD		8	/* Slack the packer writes / unpacker reads past the end */
+
+size_t sdr_pack_bound(size_t samples, size_t ssize);
+size_t sdr_pack(const void *src, size_t samples, size_t ssize, uint8_t *dst);
+int sdr_unpack(const uint8_t *src, size_t len, size_t samples, size_t ssize, void *dst);
+uint32_t sdr_adler32(const uint8_t *buf, size_t len);
+
+/* All fields little endian */
+#define SDR_REC_MAGIC		"CX88REC"
+#define SDR_REC_VERSION		1
+#define SDR_REC_FRAME_MAGIC	0x52463843	/* "C8FR" */
+
+enum {
+	SDR_REC_RAW,
+	SDR_REC_PACKED,
+};
+
+struct sdr_rec_header {
+	char		magic[8];
+	uint32_t	version;
+	uint32_t	pixelformat;
+	uint32_t	rate;
+	uint32_t	frame_size;	/* Raw bytes per frame, the last one may be short */
+	uint64_t	start_ns;	/* CLOCK_REALTIME of the first sample */
+};
+
+/* Followed by comp_len bytes. Frames are independent of each other. */
+struct sdr_rec_frame {
+	uint32_t	magic;
+	uint32_t	codec;
+	uint64_t	offset;		/* Stream byte offset of the first sample */
+	uint32_t	raw_len;
+	uint32_t	comp_len;
+	uint32_t	adler;		/* Of the raw bytes */
+	uint32_t	reserved;
+};
+
+/*
+ * <file>.idx holds one entry per frame in stream order. Offsets grow by
+ * raw_len from frame to frame unless the driver skipped data in between.
+ */
+struct sdr_rec_index {
+	uint64_t	offset;
+	uint64_t	file_pos;
+};
+
+#endif
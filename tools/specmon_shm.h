@@ -0,0 +1,35 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (c) 2020 Jorge Maidana <jorgem.seq@gmail.com>
+ *
+ * Layout of the shared memory segments published by cx88sdr_specmon, one
+ * per card, named /cx88sdr_specN.
+ *
+ * Readers copy the header and the bins while seq is even and unchanged
+ * across the copy, the same way as a seqlock.
+ */
+
+#ifndef SPECMON_SHM_H
+#define SPECMON_SHM_H
+
+#include <stdint.h>
+
+#define SPECMON_SHM_MAGIC	0x43583838	/* "CX88" */
+#define SPECMON_SHM_VERSION	1
+#define SPECMON_SHM_NAME	"/cx88sdr_spec"
+
+struct specmon_shm {
+	uint32_t	magic;
+	uint32_t	version;
+	uint32_t	bins;		/* fft_size / 2 + 1, DC to rate / 2 */
+	uint32_t	rate;		/* Real samples per second */
+	uint64_t	seq;		/* Odd while the spectrum is updated */
+	uint64_t	frames;		/* Published spectra */
+	uint64_t	dropped;	/* Frames skipped, workers busy */
+	double		timestamp;	/* CLOCK_MONOTONIC of the last update */
+	float		cpu_load;	/* Fraction of one core used for this card */
+	float		reserved;
+	float		power_db[];	/* Averaged power, dBFS */
+};
+
+#endif